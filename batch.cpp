@@ -0,0 +1,487 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Batch test runner and throughput benchmarks
+
+**************************************************************** */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "memory.h"
+#include "harts.h"
+#include "commands.h"
+#include "batch.h"
+
+using namespace std;
+
+// Steps for a .hex program, as in compiled_tests/run_test
+#define BATCH_DEFAULT_STEPS 99999999
+
+// How far a benchmark may fall behind its baseline before it counts as a regression
+#define BENCH_TOLERANCE 0.10
+
+// Runs shorter than this are mostly setting up, so their MIPS aren't compared
+#define BENCH_MIN_MS 5.0
+
+// Runs of each benchmark, unless --repeat says otherwise
+#define BENCH_DEFAULT_REPEAT 5
+
+struct batch_test {
+  string path;                // .cmd or .hex file, with the directory
+  string dir;
+  string name;
+  string expected;            // the expected log
+  bool hex;
+  bool stage2;
+  unsigned int steps;
+};
+
+enum batch_status { batch_pass, batch_fail, batch_missing, batch_crash };
+
+struct batch_result {
+  int status;
+  double ms;
+  uint64_t instructions;
+  string detail;              // what went wrong, for anything but a pass
+};
+
+static bool batch_read(const batch_options& options, vector<batch_test>& tests) {
+  ifstream in(options.manifest.c_str());
+  if (!in) {
+    cout << "Can't open batch manifest " << options.manifest << endl;
+    return false;
+  }
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    cout << "Can't find the current directory" << endl;
+    return false;
+  }
+  string suffix = string(options.verbose ? "-v" : "") + (options.cycle_reporting ? "-c" : "");
+
+  string line;
+  unsigned int line_number = 0;
+  while (getline(in, line)) {
+    line_number++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == string::npos || line[first] == '#')
+      continue;
+
+    batch_test test;
+    test.stage2 = false;
+    test.steps = BATCH_DEFAULT_STEPS;
+    stringstream words(line);
+    string word;
+    while (words >> word) {
+      if (word == "-s2")
+        test.stage2 = true;
+      else if (word == "--steps" && words >> test.steps)
+        continue;
+      else if (word[0] == '-') {
+        cout << options.manifest << ":" << dec << line_number << ": Unknown option " << word << endl;
+        return false;
+      }
+      else
+        test.path = word;
+    }
+    if (test.path.empty())
+      continue;
+
+    if (test.path[0] != '/')
+      test.path = string(cwd) + "/" + test.path;
+    size_t slash = test.path.rfind('/');
+    size_t dot = test.path.rfind('.');
+    string extension = (dot != string::npos && dot > slash) ? test.path.substr(dot) : "";
+    if (extension != ".cmd" && extension != ".hex") {
+      cout << options.manifest << ":" << dec << line_number << ": Not a .cmd or .hex file: " << test.path << endl;
+      return false;
+    }
+    test.hex = extension == ".hex";
+    test.dir = test.path.substr(0, slash);
+    test.name = test.path.substr(slash + 1, dot - slash - 1);
+    test.expected = test.dir + "/expected/" + test.name + suffix + ".log";
+    tests.push_back(test);
+  }
+  return true;
+}
+
+static vector<string> batch_lines(const string& text) {
+  vector<string> lines;
+  stringstream in(text);
+  string line;
+  while (getline(in, line))
+    lines.push_back(line);
+  return lines;
+}
+
+// A line with its whitespace taken out and in lower case, to compare the way diff -iw does
+static string batch_normalise(const string& line) {
+  string result;
+  for (size_t i = 0; i < line.length(); i++)
+    if (!isspace((unsigned char)line[i])) result += tolower((unsigned char)line[i]);
+  return result;
+}
+
+// Empty if output matches expected, otherwise the first line that differs
+static string batch_compare(const string& output, const string& expected) {
+  vector<string> got = batch_lines(output);
+  vector<string> want = batch_lines(expected);
+  for (size_t i = 0; i < got.size() || i < want.size(); i++) {
+    if (i < got.size() && i < want.size() && batch_normalise(got[i]) == batch_normalise(want[i]))
+      continue;
+    ostringstream detail;
+    detail << "line " << dec << i + 1 << ": expected " << (i < want.size() ? "\"" + want[i] + "\"" : "end of output")
+           << ", got " << (i < got.size() ? "\"" + got[i] + "\"" : "end of output");
+    return detail.str();
+  }
+  return "";
+}
+
+// Run one test on a machine of its own, with its output going to a buffer instead of cout
+static batch_result batch_run(const batch_options& options, const batch_test& test) {
+  batch_result result;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  result.instructions = 0;
+  ifstream expected_file(test.expected.c_str());
+  if (!expected_file) {
+    result.status = batch_missing;
+    result.ms = 0;
+    result.detail = "no " + test.expected;
+    return result;
+  }
+  stringstream expected;
+  expected << expected_file.rdbuf();
+
+  stringstream commands;
+  if (test.hex) {
+    commands << "l \"" << test.name << ".hex\"\nb 0\n.\n. " << dec << test.steps << "\nx10\n";
+  }
+  else {
+    ifstream command_file(test.path.c_str());
+    commands << command_file.rdbuf();
+  }
+
+  stringbuf output;
+  streambuf* saved = cout.rdbuf(&output);
+  if (chdir(test.dir.c_str()) == 0) {
+    memory mem(options.verbose);
+    if (options.ram_size != 0)
+      mem.map_ram(options.ram_base, options.ram_size);
+    hart_group harts(&mem, 1, options.verbose, options.stage2 || test.stage2, 0);
+    harts.set_threaded(options.threaded);
+    harts.set_pipeline(options.pipeline);
+    harts.set_caches(options.icache, options.dcache);
+    harts.set_predictor(options.predictor, options.predictor_cycles);
+    harts.set_profile_mix(options.profile_mix);
+    harts.set_profiler(options.profile_interval);
+    harts.set_call_graph(options.call_graph);
+    if (options.jit)
+      harts.set_jit(true);
+    interpret_commands(&mem, &harts, options.verbose, commands);
+    report_statistics(&mem, &harts, options.cycle_reporting, options.memory_stats, options.stall_stats);
+    result.instructions = harts.get_instruction_count();
+  }
+  else {
+    cout << "Can't change to " << test.dir << endl;
+  }
+  cout.rdbuf(saved);
+
+  result.detail = batch_compare(output.str(), expected.str());
+  result.status = result.detail.empty() ? batch_pass : batch_fail;
+  result.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+// A worker process runs every step-th test from first and writes a record of each result to fd:
+// "<test> <status> <ms> <instructions> <detail length>\n<detail>"
+static void batch_worker(const batch_options& options, const vector<batch_test>& tests,
+                         size_t first, size_t step, int fd) {
+  for (size_t t = first; t < tests.size(); t += step) {
+    batch_result result = batch_run(options, tests[t]);
+    ostringstream record;
+    record << dec << t << " " << result.status << " " << result.ms << " " << result.instructions << " "
+           << result.detail.length() << "\n" << result.detail;
+    string text = record.str();
+    for (size_t done = 0; done < text.length(); ) {
+      ssize_t n = write(fd, text.data() + done, text.length() - done);
+      if (n <= 0) return;
+      done += n;
+    }
+  }
+}
+
+static void batch_collect(int fd, vector<batch_result>& results) {
+  string text;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    text.append(buffer, n);
+
+  stringstream in(text);
+  size_t t, length;
+  int status;
+  double ms;
+  uint64_t instructions;
+  while (in >> t >> status >> ms >> instructions >> length && in.get() == '\n' && t < results.size() &&
+         status <= batch_crash) {
+    results[t].status = status;
+    results[t].ms = ms;
+    results[t].instructions = instructions;
+    results[t].detail.resize(length);
+    in.read(&results[t].detail[0], length);
+  }
+}
+
+// Fork a worker, see batch_worker(). fd is set to the pipe it reports on, and none of the pipes in
+// others are left open in it. Returns the worker's pid, or -1 if it couldn't be started
+static pid_t batch_start(const batch_options& options, const vector<batch_test>& tests, size_t first, size_t step,
+                         const vector<int>& others, int& fd) {
+  int ends[2];
+  if (pipe(ends) != 0) return -1;
+  cout.flush();  // or the worker would print it again
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(ends[0]);
+    for (size_t i = 0; i < others.size(); i++) close(others[i]);
+    batch_worker(options, tests, first, step, ends[1]);
+    _exit(0);
+  }
+  close(ends[1]);
+  if (pid < 0) {
+    close(ends[0]);
+    return -1;
+  }
+  fd = ends[0];
+  return pid;
+}
+
+// A test that kills its worker gets no result of its own
+static batch_result batch_crashed() {
+  batch_result result;
+  result.status = batch_crash;
+  result.ms = 0;
+  result.instructions = 0;
+  result.detail = "the worker running it exited early";
+  return result;
+}
+
+static const char* batch_status_names[] = {"pass", "FAIL", "MISSING", "CRASH"};
+
+bool run_batch(const batch_options& options) {
+  vector<batch_test> tests;
+  if (!batch_read(options, tests))
+    return false;
+
+  unsigned int jobs = options.jobs;
+  if (jobs == 0)
+    jobs = thread::hardware_concurrency();
+  if (jobs == 0)
+    jobs = 1;
+  if (jobs > tests.size())
+    jobs = tests.size() > 0 ? tests.size() : 1;
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    cwd[0] = '\0';
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  vector<batch_result> results(tests.size(), batch_crashed());
+
+  if (jobs == 1) {
+    for (size_t t = 0; t < tests.size(); t++)
+      results[t] = batch_run(options, tests[t]);
+    if (cwd[0] != '\0' && chdir(cwd) != 0)
+      cout << "Can't change back to " << cwd << endl;
+  }
+  else {
+    vector<int> fds;
+    vector<pid_t> workers;
+    for (unsigned int w = 0; w < jobs; w++) {
+      int fd;
+      pid_t pid = batch_start(options, tests, w, jobs, fds, fd);
+      if (pid < 0) break;
+      fds.push_back(fd);
+      workers.push_back(pid);
+    }
+    if (workers.empty()) {
+      cout << "Can't start batch workers" << endl;
+      return false;
+    }
+    // a worker blocked on a full pipe just waits its turn here
+    for (size_t w = 0; w < workers.size(); w++) {
+      batch_collect(fds[w], results);
+      close(fds[w]);
+      waitpid(workers[w], NULL, 0);
+    }
+    jobs = workers.size();
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  unsigned int passed = 0;
+  for (size_t t = 0; t < tests.size(); t++) {
+    const batch_result& result = results[t];
+    cout << left << setw(8) << setfill(' ') << batch_status_names[result.status] << setw(40) << tests[t].name << right
+         << fixed << setprecision(1) << setw(10) << result.ms << " ms" << endl;
+    if (result.status != batch_pass)
+      cout << "        " << result.detail << endl;
+    else
+      passed++;
+  }
+  cout << dec << tests.size() << " tests, " << passed << " passed, " << tests.size() - passed << " failed, "
+       << fixed << setprecision(2) << seconds << " s on " << jobs << (jobs == 1 ? " worker" : " workers") << endl;
+  cout.unsetf(ios::floatfield);
+  return passed == tests.size();
+}
+
+// The value after "key": in a line of the JSON run_bench writes, which has one benchmark per line
+static bool bench_field(const string& line, const string& key, string& value) {
+  size_t at = line.find("\"" + key + "\":");
+  if (at == string::npos) return false;
+  at = line.find_first_not_of(" ", at + key.length() + 3);
+  if (at == string::npos) return false;
+  if (line[at] == '"') {
+    size_t end = line.find('"', at + 1);
+    value = line.substr(at + 1, end == string::npos ? string::npos : end - at - 1);
+  }
+  else {
+    value = line.substr(at, line.find_first_of(",}", at) - at);
+  }
+  return true;
+}
+
+struct bench_numbers {
+  string status;
+  uint64_t instructions;
+  double wall_ms;             // median of the runs
+  double mips;
+  long peak_rss_kb;
+};
+
+static void bench_read_baseline(const string& path, map<string, bench_numbers>& baseline) {
+  ifstream in(path.c_str());
+  string line, name, value;
+  while (getline(in, line)) {
+    if (!bench_field(line, "name", name)) continue;
+    bench_numbers& b = baseline[name];
+    b.instructions = bench_field(line, "instructions", value) ? strtoull(value.c_str(), NULL, 10) : 0;
+    b.mips = bench_field(line, "mips", value) ? strtod(value.c_str(), NULL) : 0;
+    b.peak_rss_kb = bench_field(line, "peak_rss_kb", value) ? strtol(value.c_str(), NULL, 10) : 0;
+  }
+}
+
+bool run_bench(const batch_options& options) {
+  vector<batch_test> tests;
+  if (!batch_read(options, tests))
+    return false;
+  map<string, bench_numbers> baseline;
+  if (!options.baseline.empty())
+    bench_read_baseline(options.baseline, baseline);
+  unsigned int repeat = options.repeat != 0 ? options.repeat : BENCH_DEFAULT_REPEAT;
+
+  vector<bench_numbers> numbers(tests.size());
+  vector<string> regressions(tests.size());
+  unsigned int failed = 0, regressed = 0;
+  for (size_t t = 0; t < tests.size(); t++) {
+    // each run is a process of its own, so getrusage() gives its peak RSS alone
+    vector<double> times;
+    bench_numbers& n = numbers[t];
+    n.status = batch_status_names[batch_pass];
+    n.instructions = 0;
+    n.peak_rss_kb = 0;
+    for (unsigned int r = 0; r < repeat; r++) {
+      vector<batch_result> run(tests.size(), batch_crashed());
+      int fd;
+      pid_t pid = batch_start(options, tests, t, tests.size(), vector<int>(), fd);
+      if (pid < 0) {
+        cout << "Can't start benchmark run" << endl;
+        return false;
+      }
+      batch_collect(fd, run);
+      close(fd);
+      int exit_status;
+      struct rusage usage;
+      if (wait4(pid, &exit_status, 0, &usage) == pid && usage.ru_maxrss > n.peak_rss_kb)
+        n.peak_rss_kb = usage.ru_maxrss;
+      if (run[t].status != batch_pass) {
+        // output that doesn't match makes the timing meaningless
+        n.status = batch_status_names[run[t].status];
+        regressions[t] = run[t].detail;
+        break;
+      }
+      n.instructions = run[t].instructions;
+      times.push_back(run[t].ms);
+    }
+    sort(times.begin(), times.end());
+    n.wall_ms = times.empty() ? 0 : times[times.size() / 2];
+    n.mips = n.wall_ms > 0 ? n.instructions / (n.wall_ms * 1000) : 0;
+    if (times.size() != repeat) {
+      failed++;
+      continue;
+    }
+
+    map<string, bench_numbers>::const_iterator b = baseline.find(tests[t].name);
+    if (b == baseline.end())
+      continue;
+    ostringstream why;
+    if (n.instructions != b->second.instructions)
+      why << "instructions " << dec << n.instructions << " were " << b->second.instructions << "; ";
+    if (n.wall_ms >= BENCH_MIN_MS && n.mips < b->second.mips * (1 - BENCH_TOLERANCE))
+      why << "MIPS " << fixed << setprecision(1) << n.mips << " were " << b->second.mips << "; ";
+    if (n.peak_rss_kb > b->second.peak_rss_kb * (1 + BENCH_TOLERANCE))
+      why << "peak RSS " << dec << n.peak_rss_kb << " KB was " << b->second.peak_rss_kb << " KB; ";
+    regressions[t] = why.str();
+    if (!regressions[t].empty()) {
+      regressions[t].resize(regressions[t].length() - 2);
+      regressed++;
+    }
+  }
+
+  ofstream out(options.results.c_str());
+  if (!out) {
+    cout << "Can't write benchmark results to " << options.results << endl;
+    return false;
+  }
+  out << "{" << endl << "  \"repeat\": " << dec << repeat << "," << endl << "  \"benchmarks\": [" << endl;
+  for (size_t t = 0; t < tests.size(); t++) {
+    const bench_numbers& n = numbers[t];
+    out << "    {\"name\": \"" << tests[t].name << "\", \"status\": \"" << n.status << "\", \"instructions\": "
+        << dec << n.instructions << ", \"wall_ms\": " << fixed << setprecision(3) << n.wall_ms << ", \"mips\": "
+        << setprecision(2) << n.mips << ", \"peak_rss_kb\": " << n.peak_rss_kb << ", \"regression\": "
+        << (regressions[t].empty() || n.status != "pass" ? "false" : "true") << "}"
+        << (t + 1 < tests.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl << "}" << endl;
+
+  cout << left << setw(32) << setfill(' ') << "benchmark" << right << setw(14) << "instructions" << setw(12) << "ms"
+       << setw(10) << "MIPS" << setw(12) << "peak KB" << endl;
+  for (size_t t = 0; t < tests.size(); t++) {
+    const bench_numbers& n = numbers[t];
+    cout << left << setw(32) << tests[t].name << right << setw(14) << dec << n.instructions << fixed
+         << setprecision(2) << setw(12) << n.wall_ms << setprecision(1) << setw(10) << n.mips << setw(12)
+         << n.peak_rss_kb << endl;
+    if (n.status != "pass")
+      cout << "    " << n.status << ": " << regressions[t] << endl;
+    else if (!regressions[t].empty())
+      cout << "    REGRESSION: " << regressions[t] << endl;
+  }
+  cout << dec << tests.size() << " benchmarks, " << repeat << " runs each, " << failed << " failed, "
+       << regressed << " regressed";
+  if (!options.baseline.empty() && baseline.empty())
+    cout << ", no baseline in " << options.baseline;
+  cout << ", results in " << options.results << endl;
+  cout.unsetf(ios::floatfield);
+  return failed == 0 && regressed == 0;
+}
@@ -0,0 +1,65 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Batch test runner and throughput benchmarks: many tests in one simulator run
+
+**************************************************************** */
+
+#include <string>
+#include <cstdint>
+
+#include "pipeline.h"
+#include "cache.h"
+#include "predictor.h"
+
+using namespace std;
+
+struct batch_options {
+  string manifest;      // the tests to run, one per line
+  unsigned int jobs;    // worker processes, 0 for one per host CPU
+  bool verbose;         // the options each test runs with, as on the command line
+  bool cycle_reporting;
+  bool memory_stats;
+  bool stall_stats;
+  pipeline_config pipeline;
+  cache_config icache;  // size 0 for none
+  cache_config dcache;
+  predictor_config predictor;
+  bool predictor_cycles;
+  bool profile_mix;
+  uint64_t profile_interval;  // 0 for no pc profile
+  bool call_graph;
+  bool stage2;
+  bool threaded;
+  bool jit;
+  uint64_t ram_base;    // RAM region for each test, ram_size 0 for none
+  uint64_t ram_size;
+  unsigned int repeat;  // for run_bench: runs of each test, 0 for the default
+  string results;       // where run_bench writes its JSON
+  string baseline;      // earlier run_bench results to compare with, empty for none
+};
+
+// Run every test in options.manifest and compare its output with the expected log, the way the
+// tests/*/run_test scripts do with diff -iw. A manifest line names a .cmd file of commands, or a .hex
+// program run with "l", "b 0", ".", ". <steps>" and "x10". It may start with -s2 for stage 2, or with
+// --steps <n> to change the steps for a .hex program from 99999999. The expected output of
+// <dir>/<name>.cmd or .hex is <dir>/expected/<name>.log, with -v and -c added to the name as the
+// scripts add RV64SIM_FLAGS. Each test gets a fresh memory and processor, with its directory as the
+// current directory. Tests are shared between worker processes forked from this one, so nothing is
+// started from scratch, and their output is captured in memory.
+// Returns true if every test passed
+bool run_batch(const batch_options& options);
+
+// Time each test in options.manifest over several runs, each in a process of its own, and write the
+// instructions executed, median wall time, MIPS and peak RSS of each to options.results as JSON.
+// A test counts as a regression if it executes a different number of instructions from the baseline,
+// or if its MIPS fall or its peak RSS rises by more than 10%. MIPS aren't compared for runs under 5 ms.
+// The baseline should come from the same host, since wall time and MIPS depend on it.
+// Returns true if every test passed and none regressed
+bool run_bench(const batch_options& options);
+
+#endif
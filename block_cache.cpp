@@ -0,0 +1,870 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Predecoded basic blocks and their instruction handlers
+
+**************************************************************** */
+
+#include <iostream>
+#include <iomanip>
+
+#include "memory.h"
+#include "processor.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "Definitions.h"
+#include "LogControl.h"
+#include "Bits.h"
+
+using namespace std;
+
+#define set_reg_m(reg_num, value) \
+  if ((reg_num) != 0) { \
+    reg[reg_num] = (value); \
+  }
+//
+
+const char* const rv64::inst_kind_names[rv64::num_inst_kinds] = {
+#define X(name) #name,
+  RV64_INST_KINDS(X)
+#undef X
+};
+
+const inst_handler processor::kind_handlers[rv64::num_inst_kinds] = {
+#define X(name) &processor::op_##name,
+  RV64_INST_KINDS(X)
+#undef X
+};
+
+// Find the decoded block starting at address, decoding it first if it isn't cached
+decoded_block* processor::lookup_block(uint64_t address) {
+  // a store has landed on decoded code since the cache was built
+  if (mem->get_code_generation() != block_cache_generation) {
+    flush_block_cache();
+  }
+
+  auto found = block_cache.find(address);
+  if (found != block_cache.end()) {
+    return &found->second;
+  }
+
+  decoded_block& block = block_cache[address];
+  decode_block(address, block);
+  return &block;
+}
+
+// Decode instructions from address until a control transfer, a system instruction,
+// MAX_BLOCK_INSTRUCTIONS or the end of the memory block
+void processor::decode_block(uint64_t address, decoded_block& block) {
+  // breakpoints are only checked on entering a block, so one can only be at the start of a block.
+  // The JIT leaves those blocks to the interpreter
+  vector<breakpoint>* breakpoints_here = breakpoints.in_block(address);
+
+  block.start_pc = address;
+  block.breakpoint = breakpoint_set::at(breakpoints_here, address);
+  block.exec_count = 0;
+  block.branch_count = 0;
+  block.branch_misses = 0;
+  block.full_runs = 0;
+  block.jit_rejected = block.breakpoint;
+  block.native = NULL;
+  block.insts.clear();
+  block.insts.reserve(8);
+
+  mem->mark_code(address);
+
+  uint64_t block_end = address - (address % blockSize) + blockSize;
+  while (address < block_end && block.insts.size() < MAX_BLOCK_INSTRUCTIONS) {
+    if (address != block.start_pc && breakpoint_set::at(breakpoints_here, address)) break;
+
+    decoded_inst di;
+    decode(mem->fetch_word(address), di);
+    block.insts.push_back(di);
+
+    if (di.kind >= rv64::ecall_k && di.kind <= rv64::csrrci_k) break;
+    if (di.kind >= rv64::jal_k && di.kind <= rv64::bgeu_k) break;
+    if (di.kind == rv64::illegal_k) break;
+
+    address += 4;
+  }
+
+  fuse_block(block);
+  count_stalls(block);
+
+  vlog("Decoded block at " << std::hex << block.start_pc << ", " << std::dec << block.insts.size() << " instructions");
+}
+
+void processor::flush_block_cache() {
+  fold_branch_stats();
+  fold_inst_mix();
+  block_cache.clear();
+  block_cache_generation = mem->get_code_generation();
+  if (jit_engine != NULL) jit_engine->reset();
+}
+
+// Translate the block once it has been entered JIT_THRESHOLD times.
+// Returns true if it has a translation to run
+bool processor::jit_ready(decoded_block* block) {
+  if (block->native == NULL) {
+    if (block->jit_rejected || ++block->exec_count < JIT_THRESHOLD) return false;
+
+    block->native = jit_engine->compile(*block);
+    if (block->native == NULL && jit_engine->full()) {
+      // start again with an empty buffer, every other block will be retranslated when it's hot again
+      jit_engine->reset();
+      for (auto it = block_cache.begin(); it != block_cache.end(); ++it) {
+        it->second.native = NULL;
+        it->second.exec_count = 0;
+      }
+      block->native = jit_engine->compile(*block);
+    }
+    if (block->native == NULL) {
+      block->jit_rejected = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Run the block's translation if it has one, translating it once it is hot.
+// Returns false if nothing ran, in which case the interpreter should.
+bool processor::run_native(decoded_block* block, unsigned int& num) {
+  if (!jit_ready(block)) return false;
+
+  jit::state& st = jit_engine->st;
+  st.regs = reg;
+  st.mem = mem;
+  st.pc = pc;
+  st.budget = num;
+  st.code_generation = block_cache_generation;
+
+  jit_engine->run(block->native);
+
+  uint64_t executed = num - st.budget;
+  instruction_count += executed;
+  for (int s = 0; s < rv64::num_stalls; s++) {
+    stall_events[s] += st.stalls[s];
+    st.stalls[s] = 0;
+  }
+  num -= executed;
+  pc = st.pc;
+  return executed != 0;
+}
+
+// Look for pairs that can run as one superinstruction. Pairs never overlap
+void processor::fuse_block(decoded_block& block) {
+  for (size_t i = 0; i + 1 < block.insts.size(); i++) {
+    decoded_inst& a = block.insts[i];
+    const decoded_inst& b = block.insts[i + 1];
+    uint8_t fusion = rv64::no_fusion;
+
+    if (a.rd == 0) continue;
+
+    switch (a.kind) {
+      case rv64::lui_k:
+        if (b.rs1 == a.rd && b.rd == a.rd) {
+          if (b.kind == rv64::addi_k) fusion = rv64::fuse_lui_addi;
+          else if (b.kind == rv64::addiw_k) fusion = rv64::fuse_lui_addiw;
+        }
+      break;
+
+      case rv64::auipc_k:
+        if (b.rs1 == a.rd) {
+          if (b.kind == rv64::addi_k && b.rd == a.rd) fusion = rv64::fuse_auipc_addi;
+          else if (b.kind == rv64::jalr_k) fusion = rv64::fuse_auipc_jalr;
+        }
+      break;
+
+      case rv64::slli_k:
+        if (b.rs1 == a.rd && b.rd == a.rd) {
+          if (b.kind == rv64::srli_k) fusion = rv64::fuse_slli_srli;
+          else if (b.kind == rv64::srai_k) fusion = rv64::fuse_slli_srai;
+        }
+      break;
+
+      case rv64::slt_k:
+      case rv64::sltu_k:
+      case rv64::slti_k:
+      case rv64::sltiu_k:
+        if ((b.kind == rv64::beq_k || b.kind == rv64::bne_k) &&
+            ((b.rs1 == a.rd && b.rs2 == 0) || (b.rs1 == 0 && b.rs2 == a.rd))) {
+          fusion = rv64::fuse_set_branch;
+        }
+      break;
+    }
+
+    if (fusion == rv64::no_fusion) continue;
+
+    a.fused = fusion;
+    a.op = rv64::num_inst_kinds + fusion - 1;
+    switch (fusion) {
+#define X(name) case rv64::fuse_##name: a.handler = &processor::fused_##name; break;
+      RV64_FUSIONS(X)
+#undef X
+    }
+    i++;
+  }
+}
+
+// Does di read register r? x0 never counts
+static bool reads_reg(const decoded_inst& di, uint8_t r) {
+  if (r == 0) return false;
+  switch (di.kind) {
+    case rv64::add_k: case rv64::sub_k: case rv64::sll_k: case rv64::slt_k: case rv64::sltu_k:
+    case rv64::xor_k: case rv64::srl_k: case rv64::sra_k: case rv64::or_k: case rv64::and_k:
+    case rv64::addw_k: case rv64::subw_k: case rv64::sllw_k: case rv64::srlw_k: case rv64::sraw_k:
+    case rv64::sb_k: case rv64::sh_k: case rv64::sw_k: case rv64::sd_k:
+    case rv64::beq_k: case rv64::bne_k: case rv64::blt_k: case rv64::bge_k: case rv64::bltu_k: case rv64::bgeu_k:
+      return di.rs1 == r || di.rs2 == r;
+
+    case rv64::addi_k: case rv64::slti_k: case rv64::sltiu_k: case rv64::xori_k: case rv64::ori_k:
+    case rv64::andi_k: case rv64::slli_k: case rv64::srli_k: case rv64::srai_k:
+    case rv64::addiw_k: case rv64::slliw_k: case rv64::srliw_k: case rv64::sraiw_k:
+    case rv64::lb_k: case rv64::lh_k: case rv64::lw_k: case rv64::ld_k: case rv64::lbu_k: case rv64::lhu_k: case rv64::lwu_k:
+    case rv64::csrrw_k: case rv64::csrrs_k: case rv64::csrrc_k:
+    case rv64::jalr_k:
+      return di.rs1 == r;
+
+    default:
+      return false;
+  }
+}
+
+static inline bool is_load(const decoded_inst& di) {
+  return di.kind >= rv64::lb_k && di.kind <= rv64::lwu_k;
+}
+
+// Fill in the running totals the timing model charges blocks with. A load-use hazard is only seen
+// inside a block, which is nearly always where it is: blocks end at control transfers
+void processor::count_stalls(decoded_block& block) {
+  uint8_t loads = 0, stores = 0, load_uses = 0, jumps = 0;
+  for (size_t i = 0; i < block.insts.size(); i++) {
+    decoded_inst& di = block.insts[i];
+    if (is_load(di)) loads++;
+    else if (di.kind >= rv64::sb_k && di.kind <= rv64::sd_k) stores++;
+    else if (di.kind == rv64::jal_k || di.kind == rv64::jalr_k) jumps++;
+    if (i > 0 && is_load(block.insts[i - 1]) && reads_reg(di, block.insts[i - 1].rd)) load_uses++;
+
+    di.loads = loads;
+    di.stores = stores;
+    di.load_uses = load_uses;
+    di.jumps = jumps;
+  }
+}
+
+void processor::account_step(uint64_t inst_pc, uint32_t inst, uint8_t& load_rd) {
+  decoded_block one;
+  one.start_pc = inst_pc;
+  one.insts.resize(1);
+  decode(inst, one.insts[0]);
+  count_stalls(one);
+  one.branch_count = 0;
+  one.branch_misses = 0;
+  one.full_runs = 0;
+  account_block(&one, 1, pc);
+  inst_mix[one.insts[0].kind] += one.full_runs;
+  if (one.branch_count != 0) {
+    branch_stats& stats = branch_pcs[inst_pc];
+    stats.count += one.branch_count;
+    stats.misses += one.branch_misses;
+  }
+
+  if (reads_reg(one.insts[0], load_rd)) stall_events[rv64::load_use_stall]++;
+  load_rd = is_load(one.insts[0]) ? one.insts[0].rd : 0;
+}
+
+// Show the branch predictor the control transfer ending a block, which went to next_pc
+void processor::predict_block(decoded_block* block, uint64_t n, uint64_t next_pc) {
+  const decoded_inst& last = block->insts[n - 1];
+  uint64_t inst_pc = block->start_pc + 4*(n - 1);
+  bool miss;
+  if (last.kind >= rv64::beq_k)
+    miss = predictor->branch(inst_pc, next_pc != inst_pc + 4, next_pc);
+  else
+    miss = predictor->jump(inst_pc, last.kind == rv64::jalr_k, last.rd, last.rs1, next_pc);
+  block->branch_count++;
+  if (miss) block->branch_misses++;
+}
+
+void processor::fold_branch_stats() {
+  for (auto it = block_cache.begin(); it != block_cache.end(); ++it) {
+    decoded_block& block = it->second;
+    if (block.branch_count == 0) continue;
+    branch_stats& stats = branch_pcs[block.start_pc + 4*(block.insts.size() - 1)];
+    stats.count += block.branch_count;
+    stats.misses += block.branch_misses;
+    block.branch_count = 0;
+    block.branch_misses = 0;
+  }
+}
+
+const unordered_map<uint64_t, branch_stats>& processor::get_branch_stats() {
+  fold_branch_stats();
+  return branch_pcs;
+}
+
+// The first n instructions of a block that stopped early
+void processor::count_mix(const decoded_block* block, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++)
+    inst_mix[block->insts[i].kind]++;
+}
+
+void processor::fold_inst_mix() {
+  for (auto it = block_cache.begin(); it != block_cache.end(); ++it) {
+    decoded_block& block = it->second;
+    if (block.full_runs == 0) continue;
+    for (size_t i = 0; i < block.insts.size(); i++)
+      inst_mix[block.insts[i].kind] += block.full_runs;
+    block.full_runs = 0;
+  }
+}
+
+const uint64_t* processor::get_inst_mix() {
+  fold_inst_mix();
+  return inst_mix;
+}
+
+// Sample each instruction among the last n run from block that brought the count to next_sample
+void processor::take_samples(const decoded_block* block, uint64_t n) {
+  uint64_t before = instruction_count - n;
+  while (next_sample <= instruction_count) {
+    uint64_t index = next_sample - before - 1;
+    if (index >= n) index = n - 1;  // counted somewhere other than a block
+    pc_profiler->sample(block->start_pc + 4*index);
+    next_sample += pc_profiler->get_interval();
+  }
+}
+
+#define KIND(name) di.kind = rv64::name##_k; di.op = rv64::name##_k; di.handler = &processor::op_##name;
+
+// Pull the operand fields out of an encoding and pick its handler.
+// This follows the same opcode/funct switches as step(), anything step() would reject is illegal_k
+void processor::decode(uint32_t inst, decoded_inst& di) {
+  di.inst = inst;
+  di.rd = EXTRACT_RD_FROM_INST(inst);
+  di.rs1 = EXTRACT_RS1_FROM_INST(inst);
+  di.rs2 = EXTRACT_RS2_FROM_INST(inst);
+  di.imm = 0;
+  di.fused = rv64::no_fusion;
+  KIND(illegal);
+
+  uint8_t funct3 = EXTRACT_FUNCT3_FROM_INST(inst);
+  uint16_t funct7_3;
+
+  switch (rv64::opcode(EXTRACT_OPCODE_FROM_INST(inst))) {
+
+    case rv64::opcode::lui_op:
+      KIND(lui);
+      di.imm = static_cast<int64_t>(static_cast<int32_t>(inst & 0xFFFFF000));
+    break;
+
+    case rv64::opcode::auipc_op:
+      KIND(auipc);
+      di.imm = static_cast<int64_t>(static_cast<int32_t>(inst & 0xFFFFF000));
+    break;
+
+    case rv64::opcode::imm_op:
+      di.imm = EXTRACT_IMM12_FROM_INST(inst);
+      switch (rv64::imm_funct3(funct3)) {
+        case rv64::imm_funct3::addi_f3: KIND(addi); break;
+        case rv64::imm_funct3::slti_f3: KIND(slti); break;
+        case rv64::imm_funct3::sltiu_f3: KIND(sltiu); break;
+        case rv64::imm_funct3::xori_f3: KIND(xori); break;
+        case rv64::imm_funct3::ori_f3: KIND(ori); break;
+        case rv64::imm_funct3::andi_f3: KIND(andi); break;
+
+        case rv64::imm_funct3::srli_f3:
+        case rv64::imm_funct3::slli_f3:
+          di.rs2 = EXTRACT_SHAMT64_FROM_INST(inst);
+          funct7_3 = (USE_BITMASK(inst, 0xFC000000, 23)) | USE_BITMASK(inst, 0x00007000, 12);
+          switch (rv64::imm_funct9(funct7_3)) {
+            case rv64::imm_funct9::slli_f73: KIND(slli); break;
+            case rv64::imm_funct9::srli_f73: KIND(srli); break;
+            case rv64::imm_funct9::srai_f73: KIND(srai); break;
+            default: break;
+          }
+        break;
+
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::reg_op:
+      switch (rv64::reg_funct73(EXTRACT_FUNCT7_AND_3_FROM_INST(inst))) {
+        case rv64::reg_funct73::add_f: KIND(add); break;
+        case rv64::reg_funct73::sub_f: KIND(sub); break;
+        case rv64::reg_funct73::sll_f: KIND(sll); break;
+        case rv64::reg_funct73::slt_f: KIND(slt); break;
+        case rv64::reg_funct73::sltu_f: KIND(sltu); break;
+        case rv64::reg_funct73::xor_f: KIND(xor); break;
+        case rv64::reg_funct73::srl_f: KIND(srl); break;
+        case rv64::reg_funct73::sra_f: KIND(sra); break;
+        case rv64::reg_funct73::or_f: KIND(or); break;
+        case rv64::reg_funct73::and_f: KIND(and); break;
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::fen_op:
+      KIND(fence);
+    break;
+
+    case rv64::opcode::sys_op:
+      di.imm = (inst >> 20) & 0xfff;
+      switch (rv64::sys_funct3(funct3)) {
+        case rv64::sys_funct3::priv_f:
+          switch (rv64::priv_rs2(di.rs2)) {
+            case rv64::priv_rs2::ecall_rs2: KIND(ecall); break;
+            case rv64::priv_rs2::ebreak_rs2: KIND(ebreak); break;
+            case rv64::priv_rs2::mret_rs2: KIND(mret); break;
+            default: break;
+          }
+        break;
+        case rv64::sys_funct3::csrrw_f: KIND(csrrw); break;
+        case rv64::sys_funct3::csrrs_f: KIND(csrrs); break;
+        case rv64::sys_funct3::csrrc_f: KIND(csrrc); break;
+        case rv64::sys_funct3::csrrwi_f: KIND(csrrwi); break;
+        case rv64::sys_funct3::csrrsi_f: KIND(csrrsi); break;
+        case rv64::sys_funct3::csrrci_f: KIND(csrrci); break;
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::load_op:
+      di.imm = EXTRACT_IMM12_FROM_INST(inst);
+      switch (rv64::load_funct3(funct3)) {
+        case rv64::load_funct3::lb_f: KIND(lb); break;
+        case rv64::load_funct3::lh_f: KIND(lh); break;
+        case rv64::load_funct3::lw_f: KIND(lw); break;
+        case rv64::load_funct3::ld_f: KIND(ld); break;
+        case rv64::load_funct3::lbu_f: KIND(lbu); break;
+        case rv64::load_funct3::lhu_f: KIND(lhu); break;
+        case rv64::load_funct3::lwu_f: KIND(lwu); break;
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::store_op:
+      di.imm = EXTRACT_STORE_OFFSET_FROM_INST(inst);
+      switch (rv64::store_funct3(funct3)) {
+        case rv64::store_funct3::sb_f: KIND(sb); break;
+        case rv64::store_funct3::sh_f: KIND(sh); break;
+        case rv64::store_funct3::sw_f: KIND(sw); break;
+        case rv64::store_funct3::sd_f: KIND(sd); break;
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::jal_op:
+      KIND(jal);
+      di.imm = EXTRACT_JAL_OFFSET_FROM_INST(inst);
+    break;
+
+    case rv64::opcode::jalr_op:
+      KIND(jalr);
+      di.imm = EXTRACT_IMM12_FROM_INST(inst);
+    break;
+
+    case rv64::opcode::branch_op:
+      di.imm = EXTRACT_BRANCH_OFFSET_FROM_INST(inst);
+      switch (rv64::branch_funct3(funct3)) {
+        case rv64::branch_funct3::beq_f: KIND(beq); break;
+        case rv64::branch_funct3::bne_f: KIND(bne); break;
+        case rv64::branch_funct3::blt_f: KIND(blt); break;
+        case rv64::branch_funct3::bge_f: KIND(bge); break;
+        case rv64::branch_funct3::bltu_f: KIND(bltu); break;
+        case rv64::branch_funct3::bgeu_f: KIND(bgeu); break;
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::imm64_op:
+      di.imm = EXTRACT_IMM12_FROM_INST(inst);
+      switch (rv64::imm64_funct3(funct3)) {
+        case rv64::imm64_funct3::addiw_f3: KIND(addiw); break;
+        case rv64::imm64_funct3::slliw_f3:
+          KIND(slliw);
+          di.rs2 = EXTRACT_SHAMT32_FROM_INST(inst);
+        break;
+        case rv64::imm64_funct3::srliw_f3:
+          di.rs2 = EXTRACT_SHAMT32_FROM_INST(inst);
+          switch (rv64::imm64_funct7(EXTRACT_FUNCT7_FROM_INST(inst))) {
+            case rv64::imm64_funct7::srliw_f7: KIND(srliw); break;
+            case rv64::imm64_funct7::sraiw_f7: KIND(sraiw); break;
+            default: break;
+          }
+        break;
+        default: break;
+      }
+    break;
+
+    case rv64::opcode::reg64_op:
+      switch (rv64::reg64_funct73(EXTRACT_FUNCT7_AND_3_FROM_INST(inst))) {
+        case rv64::reg64_funct73::addw_f: KIND(addw); break;
+        case rv64::reg64_funct73::subw_f: KIND(subw); break;
+        case rv64::reg64_funct73::sllw_f: KIND(sllw); break;
+        case rv64::reg64_funct73::srlw_f: KIND(srlw); break;
+        case rv64::reg64_funct73::sraw_f: KIND(sraw); break;
+        default: break;
+      }
+    break;
+
+    default:
+    break;
+  }
+}
+
+#undef KIND
+
+// ---- Handlers ----
+// These mirror the cases in step(), minus the field extraction
+
+void processor::op_lui(const decoded_inst& di) {
+  set_reg_m(di.rd, di.imm);
+}
+
+void processor::op_auipc(const decoded_inst& di) {
+  set_reg_m(di.rd, static_cast<int64_t>(pc) + di.imm);
+}
+
+void processor::op_addi(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] + di.imm);
+}
+
+void processor::op_slti(const decoded_inst& di) {
+  set_reg_m(di.rd, (static_cast<int64_t>(reg[di.rs1]) < di.imm) ? 1 : 0);
+}
+
+void processor::op_sltiu(const decoded_inst& di) {
+  set_reg_m(di.rd, (uint64_t(reg[di.rs1]) < uint64_t(di.imm)) ? 1 : 0);
+}
+
+void processor::op_xori(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] ^ di.imm);
+}
+
+void processor::op_ori(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] | di.imm);
+}
+
+void processor::op_andi(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] & di.imm);
+}
+
+void processor::op_slli(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] << di.rs2);
+}
+
+void processor::op_srli(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] >> di.rs2);
+}
+
+void processor::op_srai(const decoded_inst& di) {
+  set_reg_m(di.rd, static_cast<int64_t>(reg[di.rs1]) >> di.rs2);
+}
+
+void processor::op_add(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] + reg[di.rs2]);
+}
+
+void processor::op_sub(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] - reg[di.rs2]);
+}
+
+void processor::op_sll(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] << (reg[di.rs2] & 0x3F));
+}
+
+void processor::op_slt(const decoded_inst& di) {
+  set_reg_m(di.rd, (static_cast<int64_t>(reg[di.rs1]) < static_cast<int64_t>(reg[di.rs2])) ? 1 : 0);
+}
+
+void processor::op_sltu(const decoded_inst& di) {
+  set_reg_m(di.rd, (reg[di.rs1] < reg[di.rs2]) ? 1 : 0);
+}
+
+void processor::op_xor(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] ^ reg[di.rs2]);
+}
+
+void processor::op_srl(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] >> (reg[di.rs2] & 0x3F));
+}
+
+void processor::op_sra(const decoded_inst& di) {
+  set_reg_m(di.rd, static_cast<int64_t>(reg[di.rs1]) >> (reg[di.rs2] & 0x3F));
+}
+
+void processor::op_or(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] | reg[di.rs2]);
+}
+
+void processor::op_and(const decoded_inst& di) {
+  set_reg_m(di.rd, reg[di.rs1] & reg[di.rs2]);
+}
+
+void processor::op_fence(const decoded_inst& di) {
+  // nothing to order in a single hart
+}
+
+// System instructions are rare and full of special cases, so they go through step() unchanged
+#define FALLBACK_HANDLER(name) \
+  void processor::op_##name(const decoded_inst& di) { \
+    step(); \
+  }
+
+FALLBACK_HANDLER(ecall)
+FALLBACK_HANDLER(ebreak)
+FALLBACK_HANDLER(mret)
+FALLBACK_HANDLER(csrrw)
+FALLBACK_HANDLER(csrrs)
+FALLBACK_HANDLER(csrrc)
+FALLBACK_HANDLER(csrrwi)
+FALLBACK_HANDLER(csrrsi)
+FALLBACK_HANDLER(csrrci)
+FALLBACK_HANDLER(illegal)
+
+#undef FALLBACK_HANDLER
+
+void processor::op_lb(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  uint64_t dwa = mem->read_doubleword(address);
+  set_reg_m(di.rd, int64_t((uint64_t((dwa >> ((address % 8)*8))) & 0xFF) << 56) >> 56);
+}
+
+void processor::op_lh(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 2 == 0) {
+    uint64_t dwa = mem->read_doubleword(address);
+    set_reg_m(di.rd, (int64_t)(int16_t)((dwa >> ((address % 8)*8)) & 0xFFFF));
+  } else {
+    exception(rv64::except::load_address_misaligned, address);
+  }
+}
+
+void processor::op_lw(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 4 == 0) {
+    set_reg_m(di.rd, int64_t(int32_t(mem->read_word(address))));
+  } else {
+    exception(rv64::except::load_address_misaligned, address);
+  }
+}
+
+void processor::op_ld(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 8 == 0) {
+    set_reg_m(di.rd, mem->read_doubleword(address));
+  } else if (stage2) {
+    exception(rv64::except::load_address_misaligned, address);
+  } else {
+    if (address % 4 != 0) std::cout << "Error: misaligned address for ld" << std::endl;
+    dropped++;
+    dropped_loads++;
+  }
+}
+
+void processor::op_lbu(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  uint64_t dwa = mem->read_doubleword(address);
+  set_reg_m(di.rd, (dwa >> ((address % 8)*8)) & 0xFF);
+}
+
+void processor::op_lhu(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 2 == 0) {
+    uint64_t dwa = mem->read_doubleword(address);
+    set_reg_m(di.rd, (dwa >> ((address % 8)*8)) & 0xFFFF);
+  } else {
+    exception(rv64::except::load_address_misaligned, address);
+  }
+}
+
+void processor::op_lwu(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 4 == 0) {
+    set_reg_m(di.rd, uint64_t(mem->read_word(address)));
+  } else {
+    exception(rv64::except::load_address_misaligned, address);
+  }
+}
+
+// A store that lands on decoded code leaves the rest of this block stale, so stop here
+// and let the next lookup rebuild the cache
+#define END_BLOCK_IF_CODE_WRITTEN \
+  if (mem->get_code_generation() != block_cache_generation) { \
+    update_pc(pc + 4); \
+  }
+
+void processor::op_sb(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  mem->write_byte(address, reg[di.rs2], 0xFF);
+  END_BLOCK_IF_CODE_WRITTEN;
+}
+
+void processor::op_sh(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 2 == 0) {
+    mem->write_half(address, reg[di.rs2], 0xFFFF);
+    END_BLOCK_IF_CODE_WRITTEN;
+  } else {
+    exception(rv64::except::store_address_misaligned, address);
+  }
+}
+
+void processor::op_sw(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 4 == 0) {
+    mem->write_word(address, reg[di.rs2], ~0UL);
+    END_BLOCK_IF_CODE_WRITTEN;
+  } else {
+    exception(rv64::except::store_address_misaligned, address);
+  }
+}
+
+void processor::op_sd(const decoded_inst& di) {
+  uint64_t address = reg[di.rs1] + di.imm;
+  if (address % 8 == 0) {
+    mem->write_doubleword(address, reg[di.rs2], ~0ULL);
+    END_BLOCK_IF_CODE_WRITTEN;
+  } else {
+    exception(rv64::except::store_address_misaligned, address);
+  }
+}
+
+#undef END_BLOCK_IF_CODE_WRITTEN
+
+void processor::op_jal(const decoded_inst& di) {
+  set_reg_m(di.rd, pc + 4);
+  update_pc(pc + di.imm);
+}
+
+void processor::op_jalr(const decoded_inst& di) {
+  uint64_t target = reg[di.rs1] + di.imm;
+
+  if (target == 0 && di.rd == 0 && di.rs1 == 0) {
+    // this signals that the program has ended
+    alive = false;
+  }
+
+  set_reg_m(di.rd, pc + 4);
+  update_pc(target);
+}
+
+void processor::op_beq(const decoded_inst& di) {
+  if (reg[di.rs1] == reg[di.rs2]) update_pc(pc + di.imm);
+}
+
+void processor::op_bne(const decoded_inst& di) {
+  if (reg[di.rs1] != reg[di.rs2]) update_pc(pc + di.imm);
+}
+
+void processor::op_blt(const decoded_inst& di) {
+  if ((int64_t)reg[di.rs1] < (int64_t)reg[di.rs2]) update_pc(pc + di.imm);
+}
+
+void processor::op_bge(const decoded_inst& di) {
+  if ((int64_t)reg[di.rs1] >= (int64_t)reg[di.rs2]) update_pc(pc + di.imm);
+}
+
+void processor::op_bltu(const decoded_inst& di) {
+  if (reg[di.rs1] < reg[di.rs2]) update_pc(pc + di.imm);
+}
+
+void processor::op_bgeu(const decoded_inst& di) {
+  if (reg[di.rs1] >= reg[di.rs2]) update_pc(pc + di.imm);
+}
+
+void processor::op_addiw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(int32_t(int32_t(reg[di.rs1]) + di.imm)));
+}
+
+void processor::op_slliw(const decoded_inst& di) {
+  set_reg_m(di.rd, (int32_t)reg[di.rs1] << di.rs2);
+}
+
+void processor::op_srliw(const decoded_inst& di) {
+  set_reg_m(di.rd, (int64_t)((int32_t)(((uint32_t)reg[di.rs1]) >> di.rs2)));
+}
+
+void processor::op_sraiw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(((int32_t)reg[di.rs1]) >> di.rs2));
+}
+
+void processor::op_addw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(int32_t(int32_t(reg[di.rs1]) + int32_t(reg[di.rs2]))));
+}
+
+void processor::op_subw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(int32_t(int32_t(reg[di.rs1]) - int32_t(reg[di.rs2]))));
+}
+
+void processor::op_sllw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(int32_t(reg[di.rs1]) << (reg[di.rs2] & 0x1F)));
+}
+
+void processor::op_srlw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(int32_t(uint32_t(reg[di.rs1]) >> (reg[di.rs2] & 0x1F))));
+}
+
+void processor::op_sraw(const decoded_inst& di) {
+  set_reg_m(di.rd, int64_t(int32_t(int32_t(reg[di.rs1]) >> (reg[di.rs2] & 0x1F))));
+}
+
+// ---- Fused pair handlers ----
+// Each leaves the pc on the second instruction, or wherever it jumps, like the two handlers in a row would
+
+void processor::fused_lui_addi(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  reg[di.rd] = di.imm + b.imm;
+  pc += 4;
+}
+
+void processor::fused_lui_addiw(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  reg[di.rd] = int64_t(int32_t(int32_t(di.imm) + b.imm));
+  pc += 4;
+}
+
+void processor::fused_auipc_addi(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  reg[di.rd] = pc + di.imm + b.imm;
+  pc += 4;
+}
+
+void processor::fused_auipc_jalr(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  uint64_t target = pc + di.imm + b.imm;
+  reg[di.rd] = pc + di.imm;
+  set_reg_m(b.rd, pc + 8);
+  update_pc(target);
+}
+
+void processor::fused_slli_srli(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  reg[di.rd] = (reg[di.rs1] << di.rs2) >> b.rs2;
+  pc += 4;
+}
+
+void processor::fused_slli_srai(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  reg[di.rd] = static_cast<int64_t>(reg[di.rs1] << di.rs2) >> b.rs2;
+  pc += 4;
+}
+
+void processor::fused_set_branch(const decoded_inst& di) {
+  const decoded_inst& b = (&di)[1];
+  uint64_t set;
+
+  switch (di.kind) {
+    case rv64::slt_k:   set = static_cast<int64_t>(reg[di.rs1]) < static_cast<int64_t>(reg[di.rs2]); break;
+    case rv64::sltu_k:  set = reg[di.rs1] < reg[di.rs2]; break;
+    case rv64::slti_k:  set = static_cast<int64_t>(reg[di.rs1]) < di.imm; break;
+    default:            set = reg[di.rs1] < uint64_t(di.imm); break;
+  }
+  reg[di.rd] = set;
+
+  pc += 4;
+  if ((b.kind == rv64::bne_k) == (set != 0)) update_pc(pc + b.imm);
+}
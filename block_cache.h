@@ -0,0 +1,119 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Predecoded basic blocks
+
+**************************************************************** */
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Longest run of instructions decoded into one block
+#define MAX_BLOCK_INSTRUCTIONS 64
+
+/**
+ * Every instruction kind the decoder can produce. Each X(name) gets an rv64::name_k enum
+ * value, a processor::op_name handler and an entry in inst_kind_names.
+ */
+#define RV64_INST_KINDS(X) \
+  X(lui) X(auipc) \
+  X(addi) X(slti) X(sltiu) X(xori) X(ori) X(andi) X(slli) X(srli) X(srai) \
+  X(add) X(sub) X(sll) X(slt) X(sltu) X(xor) X(srl) X(sra) X(or) X(and) \
+  X(fence) \
+  X(ecall) X(ebreak) X(mret) \
+  X(csrrw) X(csrrs) X(csrrc) X(csrrwi) X(csrrsi) X(csrrci) \
+  X(lb) X(lh) X(lw) X(ld) X(lbu) X(lhu) X(lwu) \
+  X(sb) X(sh) X(sw) X(sd) \
+  X(jal) X(jalr) \
+  X(beq) X(bne) X(blt) X(bge) X(bltu) X(bgeu) \
+  X(addiw) X(slliw) X(srliw) X(sraiw) \
+  X(addw) X(subw) X(sllw) X(srlw) X(sraw) \
+  X(illegal)
+
+/**
+ * Pairs of adjacent instructions the decoder runs as one superinstruction. The second
+ * instruction always reads the first one's result:
+ *   lui_addi/lui_addiw    lui rd, hi; addi(w) rd, rd, lo      (li)
+ *   auipc_addi            auipc rd, hi; addi rd, rd, lo       (la)
+ *   auipc_jalr            auipc rd, hi; jalr rd2, lo(rd)      (call)
+ *   slli_srli/slli_srai   slli rd, rs, n; srli/srai rd, rd, m (zero/sign extend)
+ *   set_branch            slt(i)(u) rd, ...; beqz/bnez rd     (compare and branch)
+ */
+#define RV64_FUSIONS(X) \
+  X(lui_addi) X(lui_addiw) X(auipc_addi) X(auipc_jalr) \
+  X(slli_srli) X(slli_srai) X(set_branch)
+
+namespace rv64 {
+  enum inst_kind {
+#define X(name) name##_k,
+    RV64_INST_KINDS(X)
+#undef X
+    num_inst_kinds
+  };
+
+  extern const char* const inst_kind_names[num_inst_kinds];
+
+  enum fusion {
+    no_fusion,
+#define X(name) fuse_##name,
+    RV64_FUSIONS(X)
+#undef X
+    num_fusions
+  };
+}
+
+class processor;
+struct decoded_inst;
+
+typedef void (processor::*inst_handler)(const decoded_inst&);
+
+// One instruction with its operand fields already pulled out of the encoding.
+// The first instruction of a fused pair keeps its own kind and fields but gets the pair's handler,
+// the second is left as it was so the pair can still be run one instruction at a time
+struct decoded_inst {
+  inst_handler handler;
+  uint8_t kind;     // rv64::inst_kind
+  uint8_t fused;    // rv64::fusion, no_fusion unless this starts a fused pair
+  uint8_t op;       // threaded core dispatch slot: kind, or num_inst_kinds + fused - 1
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;      // doubles as shamt for the immediate shifts
+  // Loads, stores, load-use hazards and jumps in the block up to and including this instruction, so
+  // the timing model can charge for any run from the start of the block with one lookup
+  uint8_t loads;
+  uint32_t inst;    // raw encoding, needed for mtval and the fallback path
+  uint8_t stores;
+  uint8_t load_uses;
+  uint8_t jumps;
+  int64_t imm;      // sign extended immediate, or the CSR number for CSR instructions
+};
+
+// A straight-line run of instructions starting at start_pc. Only the last one is a control transfer,
+// anything else that moves the pc (a trap) ends the block early.
+struct decoded_block {
+  uint64_t start_pc;
+  vector<decoded_inst> insts;
+  bool breakpoint;      // a breakpoint is at start_pc, none are further in
+
+  // Runs through the control transfer that ends the block, and how many the branch predictor got wrong.
+  // Added to the processor's counts for that pc when the block cache is flushed
+  uint64_t branch_count;
+  uint64_t branch_misses;
+
+  // Runs through to the end of the block with --profile-mix, added to the processor's instruction mix
+  // a kind at a time when the block cache is flushed
+  uint64_t full_runs;
+
+  // JIT tier: how often the block has been entered, and its translation once it gets hot
+  uint32_t exec_count;
+  bool jit_rejected;
+  void* native;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for the breakpoint set
+
+**************************************************************** */
+
+#include <iomanip>
+#include <map>
+
+#include "breakpoints.h"
+
+breakpoint_set::breakpoint_set() {
+  next_id = 1;
+}
+
+unsigned int breakpoint_set::add(uint64_t address, bool once, int reg, uint64_t value, uint64_t count) {
+  breakpoint b;
+  b.id = next_id++;
+  b.address = address;
+  b.once = once;
+  b.reg = reg;
+  b.value = value;
+  b.count = count;
+  b.hits = 0;
+  blocks[address / blockSize].push_back(b);
+  return b.id;
+}
+
+bool breakpoint_set::remove(unsigned int id) {
+  for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+    vector<breakpoint>& list = it->second;
+    for (size_t i = 0; i < list.size(); i++) {
+      if (list[i].id != id) continue;
+      list.erase(list.begin() + i);
+      if (list.empty()) blocks.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+void breakpoint_set::remove_once() {
+  for (auto it = blocks.begin(); it != blocks.end(); ) {
+    vector<breakpoint>& list = it->second;
+    for (size_t i = 0; i < list.size(); ) {
+      if (list[i].once) list.erase(list.begin() + i);
+      else i++;
+    }
+    if (list.empty()) it = blocks.erase(it);
+    else ++it;
+  }
+}
+
+void breakpoint_set::clear() {
+  blocks.clear();
+}
+
+bool breakpoint_set::at(const vector<breakpoint>* list, uint64_t address) {
+  if (list == NULL) return false;
+  for (size_t i = 0; i < list->size(); i++)
+    if ((*list)[i].address == address) return true;
+  return false;
+}
+
+void breakpoint_set::show(ostream& out) const {
+  map<unsigned int, const breakpoint*> by_id;
+  for (auto it = blocks.begin(); it != blocks.end(); ++it)
+    for (size_t i = 0; i < it->second.size(); i++)
+      by_id[it->second[i].id] = &it->second[i];
+
+  if (by_id.empty()) {
+    out << "No breakpoints" << endl;
+    return;
+  }
+  for (auto it = by_id.begin(); it != by_id.end(); ++it) {
+    const breakpoint& b = *it->second;
+    out << dec << b.id << ": " << setw(16) << setfill('0') << hex << b.address;
+    if (b.once)
+      out << " once";
+    if (b.reg != NO_CONDITION)
+      out << " x" << dec << b.reg << " == " << setw(16) << setfill('0') << hex << b.value;
+    if (b.count > 1)
+      out << " hit " << dec << b.count;
+    out << ", " << dec << b.hits << " hits" << endl;
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Breakpoint set, indexed by memory block
+
+**************************************************************** */
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "memory.h"
+
+using namespace std;
+
+#define NO_CONDITION -1
+
+struct breakpoint {
+  unsigned int id;
+  uint64_t address;
+  bool once;          // removed when it stops execution, as set by "b <address>"
+  int reg;            // register the condition tests, NO_CONDITION for none
+  uint64_t value;     // stop only when x[reg] == value
+  uint64_t count;     // stop from this hit on
+  uint64_t hits;      // times reached with the condition true
+};
+
+class breakpoint_set {
+
+ private:
+
+  // keyed by address / blockSize, so a decoded block only has to look up its own memory block
+  unordered_map<uint64_t, vector<breakpoint> > blocks;
+  unsigned int next_id;
+
+ public:
+
+  breakpoint_set();
+
+  // Returns the id of the new breakpoint
+  unsigned int add(uint64_t address, bool once, int reg, uint64_t value, uint64_t count);
+
+  // Returns false if there's no breakpoint with that id
+  bool remove(unsigned int id);
+
+  // Remove the breakpoints made with once set
+  void remove_once();
+
+  void clear();
+
+  // Breakpoints in the memory block holding address, NULL if there are none
+  inline vector<breakpoint>* in_block(uint64_t address) {
+    if (blocks.empty()) return NULL;
+    auto found = blocks.find(address / blockSize);
+    return found == blocks.end() ? NULL : &found->second;
+  }
+
+  // True if one of the breakpoints in a block's list is at address
+  static bool at(const vector<breakpoint>* list, uint64_t address);
+
+  // One line per breakpoint, in id order
+  void show(ostream& out) const;
+
+  inline bool empty() const {
+    return blocks.empty();
+  }
+};
+
+#endif
@@ -0,0 +1,195 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for cache
+
+**************************************************************** */
+
+#include <iostream>
+#include <cstring>
+#include <stdlib.h>
+
+#include "cache.h"
+
+using namespace std;
+
+const char* const cache::replacement_names[cache::num_replacements] = {
+#define X(name) #name,
+  CACHE_REPLACEMENTS(X)
+#undef X
+};
+
+cache_config::cache_config() {
+  size = 0;
+  ways = 1;
+  line = 64;
+  replacement = cache::lru;
+  write_back = true;
+}
+
+static bool power_of_two(uint64_t n) {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+bool cache_config::parse(const string& spec) {
+  char* end;
+  size = strtoull(spec.c_str(), &end, 0);
+  if (*end == 'k' || *end == 'K') {
+    size *= 1024;
+    end++;
+  }
+  ways = 0;
+  line = 0;
+  if (*end == ',') ways = strtoul(end + 1, &end, 0);
+  if (*end == ',') line = strtoul(end + 1, &end, 0);
+
+  replacement = cache::lru;
+  write_back = true;
+  string rest = *end == ',' ? string(end + 1) : string(end);
+  size_t comma = rest.find(',');
+  string policy = rest.substr(0, comma);
+  string write = comma == string::npos ? "" : rest.substr(comma + 1);
+
+  bool ok = *end == '\0' || *end == ',';
+  if (policy != "") {
+    int found = -1;
+    for (int r = 0; r < cache::num_replacements; r++)
+      if (policy == cache::replacement_names[r]) found = r;
+    ok = ok && found >= 0;
+    if (found >= 0) replacement = found;
+  }
+  if (write == "through") write_back = false;
+  else ok = ok && (write == "" || write == "back");
+
+  ok = ok && power_of_two(size) && power_of_two(ways) && power_of_two(line) && line >= 4 &&
+       size >= (uint64_t)ways * line && ways <= 64;
+  if (!ok) {
+    cout << "Bad cache: " << spec << ", expected size,ways,line[,lru|plru|random[,back|through]] in powers of two" << endl;
+    size = 0;
+  }
+  return ok;
+}
+
+cache::cache(const cache_config& config) {
+  this->config = config;
+  ways = config.ways;
+  line_mask = config.line - 1;
+  line_bits = 0;
+  while ((1ULL << line_bits) < config.line) line_bits++;
+  uint64_t sets = config.size / config.line / ways;
+  set_mask = sets - 1;
+  plru_levels = 0;
+  while ((1U << plru_levels) < ways) plru_levels++;
+  random_state = 0x9E3779B97F4A7C15ULL;
+
+  tags.assign(sets * ways, 0);
+  if (config.replacement == plru) plru_bits.assign(sets, 0);
+
+  hits = 0;
+  misses = 0;
+  evictions = 0;
+  memory_writes = 0;
+}
+
+// The way to fill on a miss: an empty one if there is one, else the policy's choice
+unsigned int cache::victim(uint64_t set) {
+  uint64_t* t = &tags[set * ways];
+  for (unsigned int w = 0; w < ways; w++)
+    if (!(t[w] & 1)) return w;
+
+  switch (config.replacement) {
+    case lru:
+      return ways - 1;
+
+    case plru: {
+      // follow the bits, which point away from the ways used last
+      uint64_t bits = plru_bits[set];
+      unsigned int node = 1;
+      unsigned int way = 0;
+      for (unsigned int level = 0; level < plru_levels; level++) {
+        unsigned int bit = (bits >> node) & 1;
+        way = way * 2 + bit;
+        node = node * 2 + bit;
+      }
+      return way;
+    }
+
+    default:
+      // xorshift64
+      random_state ^= random_state << 13;
+      random_state ^= random_state >> 7;
+      random_state ^= random_state << 17;
+      return random_state & (ways - 1);
+  }
+}
+
+// Note a use of way, which for lru moves it to the front of its set
+void cache::touch(uint64_t set, unsigned int way) {
+  if (config.replacement == lru) {
+    if (way == 0) return;
+    uint64_t* t = &tags[set * ways];
+    uint64_t used = t[way];
+    memmove(t + 1, t, way * sizeof(uint64_t));
+    t[0] = used;
+  }
+  else if (config.replacement == plru) {
+    // point every bit on the way's path at the other half
+    uint64_t bits = plru_bits[set];
+    unsigned int node = 1;
+    for (unsigned int level = 0; level < plru_levels; level++) {
+      unsigned int bit = (way >> (plru_levels - 1 - level)) & 1;
+      if (bit) bits &= ~(1ULL << node);
+      else bits |= 1ULL << node;
+      node = node * 2 + bit;
+    }
+    plru_bits[set] = bits;
+  }
+}
+
+// Kept out of line so the memory accessors that call it stay small enough to inline when there's no cache
+__attribute__((noinline)) bool cache::access(uint64_t address, bool write) {
+  uint64_t line = address & ~line_mask;
+  uint64_t set = (address >> line_bits) & set_mask;
+  uint64_t* t = &tags[set * ways];
+
+  // a valid entry for this line, dirty or not, with the dirty bit forced on
+  uint64_t key = line | 3;
+  for (unsigned int w = 0; w < ways; w++) {
+    if ((t[w] | 2) != key) continue;
+    hits++;
+    if (write) {
+      if (config.write_back) t[w] |= 2;
+      else memory_writes++;
+    }
+    touch(set, w);
+    return true;
+  }
+
+  misses++;
+  if (write && !config.write_back) {
+    memory_writes++;
+    return false;
+  }
+
+  unsigned int w = victim(set);
+  if (t[w] & 1) {
+    evictions++;
+    if (t[w] & 2) memory_writes++;
+  }
+  t[w] = line | 1 | (write ? 2 : 0);
+  touch(set, w);
+  return false;
+}
+
+void cache::fetch_run(uint64_t address, uint64_t count) {
+  while (count > 0) {
+    uint64_t in_line = (config.line - (address & line_mask)) / 4;
+    if (in_line == 0) in_line = 1;
+    if (in_line > count) in_line = count;
+    access(address, false);
+    hits += in_line - 1;
+    address += 4 * in_line;
+    count -= in_line;
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Set-associative cache model
+
+**************************************************************** */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Replacement policies. Each X(name) gets a cache::name enum value and an entry in
+ * replacement_names, which is also how --icache and --dcache spell it
+ */
+#define CACHE_REPLACEMENTS(X) \
+  X(lru) X(plru) X(random)
+
+struct cache_config {
+  uint64_t size;          // bytes, 0 for no cache
+  unsigned int ways;
+  unsigned int line;      // bytes
+  uint8_t replacement;    // cache::replacement
+  bool write_back;        // write-back and write-allocate, or write-through with no write-allocate
+
+  cache_config();
+
+  // Read "size,ways,line[,replacement[,back|through]]", size may end in k. Sizes must be powers of
+  // two, with at least one set and a line of at least 4 bytes. Returns false, with a message, if not
+  bool parse(const string& spec);
+};
+
+// Only tags are kept, the data stays in memory. The tags of a set are next to each other, each
+// the line's address with bit 0 set when valid and bit 1 when dirty, so a lookup compares one
+// word per way. With lru a set is kept in order of use, most recent first, so hits in a loop
+// usually stop at the first way and nothing else has to be stored
+class cache {
+
+ public:
+
+  enum replacement {
+#define X(name) name,
+    CACHE_REPLACEMENTS(X)
+#undef X
+    num_replacements
+  };
+
+  static const char* const replacement_names[num_replacements];
+
+ private:
+
+  cache_config config;
+  vector<uint64_t> tags;      // sets * ways
+  vector<uint64_t> plru_bits; // a tree of bits for each set, bit 1 at the root, for plru
+  uint64_t line_mask;
+  unsigned int line_bits;
+  uint64_t set_mask;
+  unsigned int ways;
+  unsigned int plru_levels;
+  uint64_t random_state;
+
+  unsigned int victim(uint64_t set);
+  void touch(uint64_t set, unsigned int way);
+
+ public:
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;         // valid lines replaced
+  uint64_t memory_writes;     // dirty lines written back, or every store when writing through
+
+  cache(const cache_config& config);
+
+  inline const cache_config& get_config() {
+    return config;
+  }
+
+  // Look up the line holding address, filling it on a miss. Returns true on a hit
+  bool access(uint64_t address, bool write);
+
+  // count instruction fetches in a row from address, looked up once for each line they touch.
+  // Fetches after the first in a line can't miss, so the counts are the same as one at a time
+  void fetch_run(uint64_t address, uint64_t count);
+};
+
+#endif
@@ -8,13 +8,18 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <string>
 #include <iomanip>
 #include <stdlib.h>
 #include <ctype.h>
+#include <map>
+#include <vector>
+#include <algorithm>
 
 #include "memory.h"
 #include "processor.h"
+#include "harts.h"
 #include "commands.h"
 
 using namespace std;
@@ -139,6 +144,66 @@ bool command_match_b(string& command, unsigned int i, bool& address_present, uin
 }
 
 
+// b + <address> [x<n> == <value>] [hit <count>]
+bool command_match_b_add(string& command, unsigned int i, uint64_t& address,
+                         bool& condition_present, unsigned int& reg_num, uint64_t& value, unsigned int& count) {
+  condition_present = false;
+  count = 1;
+  if (i == command.length() || command[i] != 'b') return false;
+  i++;
+  if (!command_skip_required_whitespace(command, i)) return false;
+  if (i == command.length() || command[i] != '+') return false;
+  i++;
+  command_skip_optional_whitespace(command, i);
+  if (!command_match_hex_number(command, i, address)) return false;
+  command_skip_optional_whitespace(command, i);
+  if (i < command.length() && command[i] == 'x') {
+    i++;
+    condition_present = true;
+    if (!command_match_decimal_number(command, i, reg_num)) return false;
+    command_skip_optional_whitespace(command, i);
+    if (command.compare(i, 2, "==") != 0) return false;
+    i += 2;
+    command_skip_optional_whitespace(command, i);
+    if (!command_match_hex_number(command, i, value)) return false;
+    command_skip_optional_whitespace(command, i);
+  }
+  if (command.compare(i, 3, "hit") == 0) {
+    i += 3;
+    if (!command_skip_required_whitespace(command, i)) return false;
+    if (!command_match_decimal_number(command, i, count)) return false;
+    command_skip_optional_whitespace(command, i);
+  }
+  return i == command.length() || command[i] == '#';
+}
+
+
+// b - <id>
+bool command_match_b_delete(string& command, unsigned int i, unsigned int& id) {
+  if (i == command.length() || command[i] != 'b') return false;
+  i++;
+  if (!command_skip_required_whitespace(command, i)) return false;
+  if (i == command.length() || command[i] != '-') return false;
+  i++;
+  command_skip_optional_whitespace(command, i);
+  if (!command_match_decimal_number(command, i, id)) return false;
+  command_skip_optional_whitespace(command, i);
+  return i == command.length() || command[i] == '#';
+}
+
+
+// b ?
+bool command_match_b_list(string& command, unsigned int i) {
+  if (i == command.length() || command[i] != 'b') return false;
+  i++;
+  if (!command_skip_required_whitespace(command, i)) return false;
+  if (i == command.length() || command[i] != '?') return false;
+  i++;
+  command_skip_optional_whitespace(command, i);
+  return i == command.length() || command[i] == '#';
+}
+
+
 bool command_match_l(string& command, unsigned int i, string& filename) {
   unsigned int j;
   if (i == command.length() || command[i] != 'l') return false;
@@ -199,21 +264,38 @@ bool command_match_csr(string& command, unsigned int i, bool& data_present, uint
 }
 
 
+// <keyword> [<number>], for snapshot, restore and hart
+bool command_match_snapshot_slot(string& command, unsigned int i, const string& keyword, bool& num_present, unsigned int& num) {
+  num_present = false;
+  if (command.compare(i, keyword.length(), keyword) != 0) return false;
+  i += keyword.length();
+  if (i == command.length() || command[i] == '#') return true;
+  if (!command_skip_required_whitespace(command, i)) return false;
+  if (command_match_decimal_number(command, i, num)) {
+    num_present = true;
+    command_skip_optional_whitespace(command, i);
+  }
+  return i == command.length() || command[i] == '#';
+}
+
+
 // Command interpreter function
-void interpret_commands(memory* main_memory, processor* cpu, bool verbose) {
+void interpret_commands(memory* main_memory, hart_group* harts, bool verbose, istream& in) {
 
   string command;
   unsigned int i;
-  bool address_present, data_present, num_present;
+  bool address_present, data_present, num_present, condition_present;
   uint64_t address, data;
-  unsigned int num;
+  unsigned int num, count, id;
   string filename;
+  map<unsigned int, hart_group::snapshot*> snapshots;  // by slot number
 
   while (true) {
-    getline(cin, command);  // Read the next line of input
-    if (!cin) break;        // Exit if end of input file
+    getline(in, command);   // Read the next line of input
+    if (!in) break;         // Exit if end of input file
     i = 0;
     command_skip_optional_whitespace(command, i);
+    processor* cpu = harts->current();  // the selected hart
     if (command_match_blank(command, i)) {  // Check for blank command
       // Nothing to do
     }
@@ -237,6 +319,9 @@ void interpret_commands(memory* main_memory, processor* cpu, bool verbose) {
       }
     }
     else if (command_match_m(command, i, data_present, address, data)) {  // Check for m command
+      // the debugger looking at memory isn't the program, so it mustn't show up in the D-cache model
+      cache* dcache = main_memory->get_dcache();
+      main_memory->set_dcache(NULL);
       if (!data_present) {  // No new value, so just show memory word value
 	data = main_memory->read_doubleword(address);
 	cout << setw(16) << setfill('0') << hex << data << endl;
@@ -244,27 +329,45 @@ void interpret_commands(memory* main_memory, processor* cpu, bool verbose) {
       else {  // Update memory doubleword
         main_memory->write_doubleword(address, data, 0xffffffffffffffffULL);
       }
+      main_memory->set_dcache(dcache);
     }
     else if (command_match_dot(command, i, num_present, num)) {  // Check for . command
       if (!num_present) {  // No instruction count value
-        cpu->execute(1, false);  // so just execute one instruction without breakpoint check
+        harts->execute(1, false);  // so just execute one instruction without breakpoint check
       }
       else {
-        cpu->execute(num, true);  // Execute specified number of instructions with breakpoint check
+        harts->execute(num, true);  // Execute specified number of instructions with breakpoint check
       }
     }
     else if (command_match_b(command, i, address_present, address)) {  // Check for b command
       if (!address_present) {  // No address value
-        cpu->clear_breakpoint();  // so just clear breakpoint
+        cpu->clear_breakpoint();  // so just clear all breakpoints
       }
       else {
         cpu->set_breakpoint(address);  // Set breakpoint at the address
       }
     }
+    else if (command_match_b_add(command, i, address, condition_present, num, data, count)) {  // Check for b + command
+      if (condition_present && num > 31) {
+        cout << "Incorrect register number" << endl;
+      }
+      else {
+        id = cpu->add_breakpoint(address, condition_present ? (int)num : NO_CONDITION, data, count);
+        cout << "Breakpoint " << dec << id << " at " << setw(16) << setfill('0') << hex << address << endl;
+      }
+    }
+    else if (command_match_b_delete(command, i, id)) {  // Check for b - command
+      if (!cpu->delete_breakpoint(id)) {
+        cout << "No breakpoint " << dec << id << endl;
+      }
+    }
+    else if (command_match_b_list(command, i)) {  // Check for b ? command
+      cpu->show_breakpoints();
+    }
     else if (command_match_l(command, i, filename)) {  // Check for l command
       uint64_t start_address;
       if (main_memory->load_file(filename, start_address)) {  // Load using the specified file name
-        cpu->set_pc(start_address);
+        harts->set_pc(start_address);  // every hart starts at the entry point
       }
     }
     else if (command_match_prv(command, i, num_present, num)) {  // Check for prv command
@@ -287,8 +390,318 @@ void interpret_commands(memory* main_memory, processor* cpu, bool verbose) {
         cpu->set_csr(address, data);  // Update memory word
       }
     }
+    else if (command_match_snapshot_slot(command, i, "snapshot", num_present, num)) {  // Check for snapshot command
+      if (!num_present) num = 0;
+      if (snapshots.count(num)) harts->free_snapshot(snapshots[num]);  // replaces what was in the slot
+      snapshots[num] = harts->take_snapshot();
+    }
+    else if (command_match_snapshot_slot(command, i, "restore", num_present, num)) {  // Check for restore command
+      if (!num_present) num = 0;
+      if (!snapshots.count(num)) {
+        cout << "No snapshot " << dec << num << endl;
+      }
+      else {
+        harts->restore_snapshot(snapshots[num]);
+      }
+    }
+    else if (command_match_snapshot_slot(command, i, "hart", num_present, num)) {  // Check for hart command
+      if (!num_present) {  // No hart number
+        cout << dec << harts->get_selected() << endl;  // so just show the selected hart
+      }
+      else if (num >= harts->size()) {
+        cout << "Incorrect hart number" << endl;
+      }
+      else {
+        harts->select(num);  // x, pc, prv, csr and b now apply to this hart
+      }
+    }
     else {
       cout << "Unrecognized command" << endl;
     }
   }
+
+  for (auto it = snapshots.begin(); it != snapshots.end(); ++it)
+    harts->free_snapshot(it->second);
+}
+
+
+// pcs listed at exit as the most mispredicted
+#define PREDICTOR_REPORT_PCS 10
+
+// part as a percentage of whole, to two places
+static string percent(uint64_t part, uint64_t whole) {
+  stringstream out;
+  out << fixed << setprecision(2) << (whole != 0 ? 100.0 * part / whole : 100.0) << "%";
+  return out.str();
+}
+
+static bool more_mispredicted(const pair<uint64_t, branch_stats>& a, const pair<uint64_t, branch_stats>& b) {
+  return a.second.misses != b.second.misses ? a.second.misses > b.second.misses : a.first < b.first;
+}
+
+// The branch predictor's totals, then the pcs it got wrong most often with the symbols they're in
+static void report_predictor(memory* main_memory, processor* hart, const string& prefix) {
+  branch_predictor* predictor = hart->get_predictor();
+  const predictor_config& config = predictor->get_config();
+  cout << prefix << "Branch predictor: " << branch_predictor::kind_names[config.kind] << ", " << dec
+       << (1U << config.table_bits) << " counters, " << config.btb_entries << " entry BTB, "
+       << config.ras_entries << " entry RAS" << endl;
+  cout << prefix << "Branches: " << predictor->branches << ", mispredicted " << predictor->branch_misses
+       << " (" << percent(predictor->branches - predictor->branch_misses, predictor->branches) << " correct)" << endl;
+  cout << prefix << "Jumps: " << predictor->jumps << ", mispredicted " << predictor->jump_misses
+       << " (" << percent(predictor->jumps - predictor->jump_misses, predictor->jumps) << " correct)" << endl;
+
+  const unordered_map<uint64_t, branch_stats>& by_pc = hart->get_branch_stats();
+  vector<pair<uint64_t, branch_stats> > worst;
+  for (auto it = by_pc.begin(); it != by_pc.end(); ++it)
+    if (it->second.misses != 0) worst.push_back(*it);
+  sort(worst.begin(), worst.end(), more_mispredicted);
+  if (worst.size() > PREDICTOR_REPORT_PCS) worst.resize(PREDICTOR_REPORT_PCS);
+  if (worst.empty()) return;
+
+  cout << prefix << "Most mispredicted:" << endl;
+  for (size_t i = 0; i < worst.size(); i++) {
+    const branch_stats& stats = worst[i].second;
+    cout << prefix << "  " << setw(16) << setfill('0') << hex << worst[i].first;
+    const symbol* sym = main_memory->get_symbols().find(worst[i].first);
+    if (sym != NULL) cout << " " << sym->name << "+0x" << hex << worst[i].first - sym->address;
+    cout << ": " << dec << stats.misses << " of " << stats.count << " mispredicted ("
+         << percent(stats.count - stats.misses, stats.count) << " correct)" << endl;
+  }
+}
+
+// by count, then in the order the kinds are declared
+static bool more_executed(const pair<uint64_t, int>& a, const pair<uint64_t, int>& b) {
+  return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+// Instruction kinds executed by every hart together, most frequent first, leaving out kinds never run
+static vector<pair<uint64_t, int> > inst_mix(hart_group* harts, uint64_t& total) {
+  uint64_t counts[rv64::num_inst_kinds] = {};
+  for (unsigned int n = 0; n < harts->size(); n++) {
+    const uint64_t* mix = harts->hart(n)->get_inst_mix();
+    for (int k = 0; k < rv64::num_inst_kinds; k++) counts[k] += mix[k];
+  }
+  vector<pair<uint64_t, int> > sorted;
+  total = 0;
+  for (int k = 0; k < rv64::num_inst_kinds; k++) {
+    total += counts[k];
+    if (counts[k] != 0) sorted.push_back(make_pair(counts[k], k));
+  }
+  sort(sorted.begin(), sorted.end(), more_executed);
+  return sorted;
+}
+
+static void report_inst_mix(hart_group* harts) {
+  uint64_t total;
+  vector<pair<uint64_t, int> > mix = inst_mix(harts, total);
+  cout << "Instruction mix:" << endl;
+  for (size_t i = 0; i < mix.size(); i++)
+    cout << "  " << left << setw(10) << setfill(' ') << rv64::inst_kind_names[mix[i].second] << right << setw(14)
+         << dec << mix[i].first << setw(9) << percent(mix[i].first, total) << endl;
+}
+
+bool write_inst_mix_json(hart_group* harts, const string& path) {
+  ofstream out(path.c_str());
+  if (!out) {
+    cout << "Can't write instruction mix to " << path << endl;
+    return false;
+  }
+  uint64_t total;
+  vector<pair<uint64_t, int> > mix = inst_mix(harts, total);
+  out << "{" << endl << "  \"instructions\": " << dec << total << "," << endl << "  \"mix\": [" << endl;
+  for (size_t i = 0; i < mix.size(); i++) {
+    out << "    {\"kind\": \"" << rv64::inst_kind_names[mix[i].second] << "\", \"count\": " << mix[i].first
+        << ", \"percent\": " << fixed << setprecision(4) << 100.0 * mix[i].first / total << "}"
+        << (i + 1 < mix.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl << "}" << endl;
+  return true;
+}
+
+// functions listed at exit by the pc profile
+#define PROFILE_REPORT_FUNCTIONS 20
+
+struct function_samples {
+  string name;
+  uint64_t self;    // samples in the function itself
+  uint64_t total;   // samples in it or anything it called
+};
+
+static bool more_sampled(const function_samples& a, const function_samples& b) {
+  if (a.self != b.self) return a.self > b.self;
+  if (a.total != b.total) return a.total > b.total;
+  return a.name < b.name;
+}
+
+// The functions the pc profile sampled most often, and the calls they were inside
+static void report_profile(memory* main_memory, processor* hart, const string& prefix) {
+  profiler* prof = hart->get_profiler();
+  map<string, uint64_t> stacks = prof->collapsed(main_memory->get_symbols());
+
+  map<string, function_samples> functions;
+  for (auto it = stacks.begin(); it != stacks.end(); ++it) {
+    vector<string> names;
+    stringstream path(it->first);
+    string name;
+    while (getline(path, name, ';')) {
+      // recursion only counts once towards the total
+      if (find(names.begin(), names.end(), name) == names.end()) {
+        function_samples& f = functions[name];
+        f.name = name;
+        f.total += it->second;
+      }
+      names.push_back(name);
+    }
+    functions[names.back()].self += it->second;
+  }
+  vector<function_samples> sorted;
+  for (auto it = functions.begin(); it != functions.end(); ++it) sorted.push_back(it->second);
+  sort(sorted.begin(), sorted.end(), more_sampled);
+  if (sorted.size() > PROFILE_REPORT_FUNCTIONS) sorted.resize(PROFILE_REPORT_FUNCTIONS);
+
+  cout << prefix << "Profile: " << dec << prof->sample_count << " samples, one every " << prof->get_interval()
+       << " instructions" << endl;
+  if (sorted.empty()) return;
+  cout << prefix << "     self    total  function" << endl;
+  for (size_t i = 0; i < sorted.size(); i++)
+    cout << prefix << right << setw(9) << setfill(' ') << percent(sorted[i].self, prof->sample_count) << setw(9)
+         << percent(sorted[i].total, prof->sample_count) << "  " << sorted[i].name << endl;
+}
+
+// functions and calls listed at exit by the call graph
+#define CALL_GRAPH_REPORT_LINES 20
+
+static void add_stats(call_stats& to, const call_stats& from) {
+  to.calls += from.calls;
+  to.self_instructions += from.self_instructions;
+  to.instructions += from.instructions;
+  to.self_cycles += from.self_cycles;
+  to.cycles += from.cycles;
+}
+
+static bool more_inclusive(const pair<string, call_stats>& a, const pair<string, call_stats>& b) {
+  if (a.second.instructions != b.second.instructions) return a.second.instructions > b.second.instructions;
+  if (a.second.self_instructions != b.second.self_instructions) return a.second.self_instructions > b.second.self_instructions;
+  return a.first < b.first;
+}
+
+static void report_call_lines(const map<string, call_stats>& by_name, const string& heading, const string& prefix) {
+  vector<pair<string, call_stats> > sorted(by_name.begin(), by_name.end());
+  sort(sorted.begin(), sorted.end(), more_inclusive);
+  if (sorted.size() > CALL_GRAPH_REPORT_LINES) sorted.resize(CALL_GRAPH_REPORT_LINES);
+  cout << prefix << "  " << left << setw(32) << setfill(' ') << heading << right << setw(10) << "calls"
+       << setw(16) << "self instrs" << setw(16) << "instrs" << setw(16) << "self cycles" << setw(16) << "cycles" << endl;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    const call_stats& s = sorted[i].second;
+    cout << prefix << "  " << left << setw(32) << sorted[i].first << right << dec << setw(10) << s.calls
+         << setw(16) << s.self_instructions << setw(16) << s.instructions << setw(16) << s.self_cycles
+         << setw(16) << s.cycles << endl;
+  }
+}
+
+// Instructions and cycles in each function and each call between two, with what they called (inclusive)
+// and without (self). Functions and calls with the same names are put together
+static void report_call_graph(memory* main_memory, processor* hart, const string& prefix) {
+  unordered_map<uint64_t, call_stats> functions;
+  map<call_edge, call_stats> edges;
+  uint64_t instructions = hart->get_instruction_count();
+  uint64_t cycles = hart->get_cycle_count();
+  hart->get_call_graph()->totals(instructions, cycles, functions, edges);
+
+  const symbol_table& symbols = main_memory->get_symbols();
+  map<string, call_stats> function_names;
+  for (auto it = functions.begin(); it != functions.end(); ++it)
+    add_stats(function_names[function_name(symbols, it->first)], it->second);
+  map<string, call_stats> edge_names;
+  for (auto it = edges.begin(); it != edges.end(); ++it)
+    add_stats(edge_names[function_name(symbols, it->first.first) + " -> " + function_name(symbols, it->first.second)],
+              it->second);
+
+  cout << prefix << "Call graph: " << dec << functions.size() << " functions, " << edges.size() << " calls between them" << endl;
+  report_call_lines(function_names, "function", prefix);
+  report_call_lines(edge_names, "call", prefix);
+}
+
+bool write_flame_graph(memory* main_memory, hart_group* harts, const string& path) {
+  ofstream out(path.c_str());
+  if (!out) {
+    cout << "Can't write flame graph stacks to " << path << endl;
+    return false;
+  }
+  for (unsigned int n = 0; n < harts->size(); n++) {
+    profiler* prof = harts->hart(n)->get_profiler();
+    if (prof == NULL) continue;
+    map<string, uint64_t> stacks = prof->collapsed(main_memory->get_symbols());
+    for (auto it = stacks.begin(); it != stacks.end(); ++it) {
+      if (harts->size() > 1) out << "hart " << n << ";";
+      out << it->first << " " << dec << it->second << endl;
+    }
+  }
+  return true;
+}
+
+// Final statistics
+void report_statistics(memory* main_memory, hart_group* harts, bool cycle_reporting, bool memory_stats, bool stall_stats) {
+  cout << "Instructions executed: " << dec << harts->get_instruction_count() << endl;
+  if (harts->size() > 1) {
+    for (unsigned int n = 0; n < harts->size(); n++)
+      cout << "Hart " << n << " instructions executed: " << harts->hart(n)->get_instruction_count() << endl;
+  }
+
+  // each hart keeps its own clock, so with more than one there's a line for each
+  for (unsigned int n = 0; n < harts->size(); n++) {
+    string prefix = harts->size() > 1 ? "Hart " + to_string(n) + " " : "";
+    if (cycle_reporting) {
+      // Required for postgraduate Computer Architecture course
+      cout << prefix << "CPU cycle count: " << dec << harts->hart(n)->get_cycle_count() << endl;
+    }
+
+    if (stall_stats) {
+      cout << prefix << "Stall cycles:";
+      for (int s = 0; s < rv64::num_stalls; s++)
+        cout << (s == 0 ? " " : ", ") << rv64::stall_names[s] << " " << dec << harts->hart(n)->get_stall_cycles(rv64::stall(s));
+      cout << endl;
+    }
+  }
+
+  if (memory_stats) {
+    cout << "Guest pages allocated: " << dec << main_memory->get_page_count() << endl;
+    cout << "Host memory used: " << dec << main_memory->get_memory_use() << " bytes" << endl;
+    cout << "TLB hits/misses: fetch " << main_memory->get_tlb_hits(memory::tlb_fetch)
+         << "/" << main_memory->get_tlb_misses(memory::tlb_fetch)
+         << ", read " << main_memory->get_tlb_hits(memory::tlb_read)
+         << "/" << main_memory->get_tlb_misses(memory::tlb_read)
+         << ", write " << main_memory->get_tlb_hits(memory::tlb_write)
+         << "/" << main_memory->get_tlb_misses(memory::tlb_write) << endl;
+  }
+
+  // the caches and predictors are per hart, so say whose they are when there's more than one
+  for (unsigned int n = 0; n < harts->size(); n++) {
+    cache* caches[2] = { harts->hart(n)->get_icache(), harts->hart(n)->get_dcache() };
+    for (int i = 0; i < 2; i++) {
+      if (caches[i] == NULL) continue;
+      if (harts->size() > 1) cout << "Hart " << dec << n << " ";
+      cout << (i == 0 ? "I-cache" : "D-cache") << " hits/misses: " << dec << caches[i]->hits << "/" << caches[i]->misses
+           << ", evictions " << caches[i]->evictions << ", memory writes " << caches[i]->memory_writes << endl;
+    }
+    if (harts->hart(n)->get_predictor() != NULL) {
+      stringstream prefix;
+      if (harts->size() > 1) prefix << "Hart " << n << " ";
+      report_predictor(main_memory, harts->hart(n), prefix.str());
+    }
+    if (harts->hart(n)->get_profiler() != NULL) {
+      stringstream prefix;
+      if (harts->size() > 1) prefix << "Hart " << n << " ";
+      report_profile(main_memory, harts->hart(n), prefix.str());
+    }
+    if (harts->hart(n)->get_call_graph() != NULL) {
+      stringstream prefix;
+      if (harts->size() > 1) prefix << "Hart " << n << " ";
+      report_call_graph(main_memory, harts->hart(n), prefix.str());
+    }
+  }
+
+  if (harts->hart(0)->get_profile_mix())
+    report_inst_mix(harts);
 }
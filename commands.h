@@ -11,7 +11,24 @@
 
 #include "memory.h"
 #include "processor.h"
+#include "harts.h"
 
-void interpret_commands(memory* main_memory, processor* cpu, bool verbose);
+#include <iostream>
+
+using namespace std;
+
+// Run the commands read from in until it runs out
+void interpret_commands(memory* main_memory, hart_group* harts, bool verbose, istream& in);
+
+// The statistics printed once the commands have run. With more than one hart, the cycles, and with
+// stall_stats where they went, are given for each hart
+void report_statistics(memory* main_memory, hart_group* harts, bool cycle_reporting, bool memory_stats, bool stall_stats);
+
+// Write the harts' instruction mix to path as JSON. Returns false, with a message, if it can't
+bool write_inst_mix_json(hart_group* harts, const string& path);
+
+// Write the harts' pc profiles to path as collapsed stacks for flame graph tools, one "a;b;c samples"
+// line per stack. Returns false, with a message, if it can't
+bool write_flame_graph(memory* main_memory, hart_group* harts, const string& path);
 
 #endif
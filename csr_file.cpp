@@ -0,0 +1,23 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   CSR number to register file slot index
+
+**************************************************************** */
+
+#include "csr_file.h"
+
+namespace rv64 {
+  uint8_t csr_slots[CSR_NUMBERS];
+
+  // Fills in csr_slots during static initialisation
+  static struct csr_slots_init {
+    csr_slots_init() {
+      for (int n = 0; n < CSR_NUMBERS; n++)
+        csr_slots[n] = num_csr_slots;
+      for (int slot = 0; slot < num_csr_slots; slot++)
+        csr_slots[csr_table[slot].number] = slot;
+    }
+  } init_csr_slots;
+}
@@ -0,0 +1,93 @@
+#ifndef CSR_FILE_H
+#define CSR_FILE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Dense CSR register file
+
+**************************************************************** */
+
+#include <cstdint>
+
+#include "Definitions.h"
+
+using namespace std;
+
+/**
+ * Every implemented CSR: X(name, reset value, write mask, fixed bits, read only, privilege).
+ * A write keeps the bits in the mask and then sets the fixed bits. The ones the interrupt check
+ * reads come first so they share a cache line with the start of the register file.
+ * mtvec also drops bits 1..7 in vectored mode, see processor::set_csr.
+ */
+#define RV64_CSRS(X) \
+  X(mstatus,   0x0000000200000000ULL, 0x0000000000001888ULL, 0x0000000200000000ULL, false, 3) \
+  X(mie,       0x0000000000000000ULL, 0x0000000000000999ULL, 0x0000000000000000ULL, false, 3) \
+  X(mip,       0x0000000000000000ULL, 0x0000000000000999ULL, 0x0000000000000000ULL, false, 3) \
+  X(mtvec,     0x0000000000000000ULL, 0xfffffffffffffffdULL, 0x0000000000000000ULL, false, 3) \
+  X(mepc,      0x0000000000000000ULL, 0xfffffffffffffffcULL, 0x0000000000000000ULL, false, 3) \
+  X(mcause,    0x0000000000000000ULL, 0x800000000000000fULL, 0x0000000000000000ULL, false, 3) \
+  X(mtval,     0x0000000000000000ULL, 0xffffffffffffffffULL, 0x0000000000000000ULL, false, 3) \
+  X(mscratch,  0x0000000000000000ULL, 0xffffffffffffffffULL, 0x0000000000000000ULL, false, 3) \
+  X(misa,      0x8000000000100100ULL, 0x0000000000000000ULL, 0x8000000000100100ULL, false, 3) \
+  X(mvendorid, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, true,  3) \
+  X(marchid,   0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, true,  3) \
+  X(mimpid,    0x2023020000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, true,  3) \
+  X(mhartid,   0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, true,  3)
+
+namespace rv64 {
+  // Position of each CSR in the register file
+  enum csr_slot {
+#define X(name, reset, mask, fixed, read_only, priv) name##_s,
+    RV64_CSRS(X)
+#undef X
+    num_csr_slots
+  };
+
+  struct csr_info {
+    uint16_t number;
+    uint64_t reset;
+    uint64_t write_mask;
+    uint64_t fixed;
+    bool read_only;
+    uint8_t priv;     // lowest privilege level allowed to access it
+  };
+
+  constexpr csr_info csr_table[num_csr_slots] = {
+#define X(name, reset, mask, fixed, read_only, priv) {csr::name, reset, mask, fixed, read_only, priv},
+    RV64_CSRS(X)
+#undef X
+  };
+
+  // Slot of every 12 bit CSR number, num_csr_slots for those that aren't implemented. Built from
+  // RV64_CSRS before main() runs, so a CSR instruction finds its register with one lookup
+#define CSR_NUMBERS 4096
+  extern uint8_t csr_slots[CSR_NUMBERS];
+
+  // Slot for a CSR number, -1 if the CSR isn't implemented
+  inline int csr_slot_of(unsigned int number) {
+    if (number >= CSR_NUMBERS || csr_slots[number] == num_csr_slots) return -1;
+    return csr_slots[number];
+  }
+}
+
+class csr_file {
+
+ public:
+
+  // One extra slot soaks up accesses to numbers that aren't CSRs
+  uint64_t value[rv64::num_csr_slots + 1];
+
+  inline uint64_t& operator[](unsigned int number) {
+    return value[number < CSR_NUMBERS ? rv64::csr_slots[number] : rv64::num_csr_slots];
+  }
+
+  inline void reset() {
+    for (int i = 0; i < rv64::num_csr_slots; i++)
+      value[i] = rv64::csr_table[i].reset;
+    value[rv64::num_csr_slots] = 0;
+  }
+};
+
+#endif
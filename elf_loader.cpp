@@ -0,0 +1,98 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   ELF64 loader members for memory
+
+**************************************************************** */
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <elf.h>
+
+#include "memory.h"
+using namespace std;
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+// Load an ELF file that's already in memory. Every PT_LOAD segment is copied to its virtual address,
+// with the part past the end of the file data zeroed. The symbol table is kept if there is one.
+bool memory::load_elf_image(const uint8_t* data, size_t size, uint64_t &start_address) {
+  const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)data;
+  if (size < sizeof(Elf64_Ehdr) || ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB
+      || ehdr->e_machine != EM_RISCV) {
+    cout << "Not a 64-bit little-endian RISC-V ELF file" << endl;
+    return false;
+  }
+  if (ehdr->e_type != ET_EXEC) {
+    cout << "ELF file is not an executable" << endl;
+    return false;
+  }
+  if (ehdr->e_phoff > size || (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > size - ehdr->e_phoff) {
+    cout << "ELF program headers are outside the file" << endl;
+    return false;
+  }
+
+  const Elf64_Phdr* phdr = (const Elf64_Phdr*)(data + ehdr->e_phoff);
+  uint64_t byte_count = 0;
+  for (int i = 0; i < ehdr->e_phnum; i++) {
+    if (phdr[i].p_type != PT_LOAD)
+      continue;
+    if (phdr[i].p_offset > size || phdr[i].p_filesz > size - phdr[i].p_offset || phdr[i].p_filesz > phdr[i].p_memsz) {
+      cout << "ELF segment " << dec << i << " is outside the file" << endl;
+      return false;
+    }
+    write_block(phdr[i].p_vaddr, data + phdr[i].p_offset, phdr[i].p_filesz);
+    byte_count += phdr[i].p_filesz;
+
+    // .bss and anything else without file data
+    static const uint8_t zeros[blockSize] = {0};
+    uint64_t address = phdr[i].p_vaddr + phdr[i].p_filesz;
+    uint64_t remaining = phdr[i].p_memsz - phdr[i].p_filesz;
+    while (remaining > 0) {
+      uint64_t chunk = remaining < blockSize ? remaining : blockSize;
+      write_block(address, zeros, chunk);
+      address += chunk;
+      remaining -= chunk;
+    }
+  }
+
+  // Symbols: the first SHT_SYMTAB section and the string table it links to
+  if (ehdr->e_shoff != 0 && ehdr->e_shoff <= size
+      && (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) <= size - ehdr->e_shoff) {
+    const Elf64_Shdr* shdr = (const Elf64_Shdr*)(data + ehdr->e_shoff);
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+      if (shdr[i].sh_type != SHT_SYMTAB || shdr[i].sh_link >= ehdr->e_shnum)
+        continue;
+      const Elf64_Shdr& strtab = shdr[shdr[i].sh_link];
+      if (shdr[i].sh_offset > size || shdr[i].sh_size > size - shdr[i].sh_offset
+          || strtab.sh_offset > size || strtab.sh_size > size - strtab.sh_offset)
+        break;
+      const Elf64_Sym* sym = (const Elf64_Sym*)(data + shdr[i].sh_offset);
+      const char* names = (const char*)(data + strtab.sh_offset);
+      size_t count = shdr[i].sh_size / sizeof(Elf64_Sym);
+      for (size_t j = 0; j < count; j++) {
+        int type = ELF64_ST_TYPE(sym[j].st_info);
+        if (sym[j].st_shndx == SHN_UNDEF || sym[j].st_name == 0 || sym[j].st_name >= strtab.sh_size)
+          continue;
+        if (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE)
+          continue;
+        const char* name = names + sym[j].st_name;
+        if (memchr(name, 0, strtab.sh_size - sym[j].st_name) == NULL)
+          continue;
+        if (name[0] == '$' || (name[0] == '.' && name[1] == 'L'))
+          continue;  // mapping symbols and local labels
+        symbols.add(sym[j].st_value, sym[j].st_size, type == STT_FUNC, name);
+      }
+      break;
+    }
+  }
+
+  start_address = ehdr->e_entry;
+  cout << dec << byte_count << " bytes loaded, start address = "
+       << setw(16) << setfill('0') << hex << start_address << endl;
+  return true;
+}
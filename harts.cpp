@@ -0,0 +1,236 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for hart_group
+
+**************************************************************** */
+
+#include <iostream>
+
+#include "harts.h"
+
+using namespace std;
+
+hart_group::hart_group(memory* shared, unsigned int count, bool verbose, bool stage2, unsigned int quantum) {
+  this->shared = shared;
+  this->quantum = quantum != 0 ? quantum : DEFAULT_QUANTUM;
+  this->selected = 0;
+  this->verbose = verbose;
+  this->base = NULL;
+  this->quantum_num = 0;
+  this->quantum_check = false;
+  this->quantum_resume = false;
+  this->round = 0;
+  this->pending = 0;
+  this->stopping = false;
+
+  if (count == 0) count = 1;
+  for (unsigned int n = 0; n < count; n++) {
+    memory* mem = shared;
+    if (count > 1) {
+      mem = new memory(verbose);
+      mem->set_store_tracking(true);
+      views.push_back(mem);
+    }
+    processor* hart = new processor(mem, verbose, stage2);
+    hart->set_hartid(n);
+    // messages from harts running side by side would come out in any order, so execute() reports them
+    if (count > 1) hart->set_quiet(true);
+    harts.push_back(hart);
+  }
+  running.assign(count, 0);
+}
+
+hart_group::~hart_group() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  start_quantum.notify_all();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  for (size_t n = 0; n < harts.size(); n++)
+    delete harts[n];
+  for (size_t n = 0; n < views.size(); n++)
+    delete views[n];
+}
+
+void hart_group::set_threaded(bool threaded) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_threaded(threaded);
+}
+
+bool hart_group::set_jit(bool enabled) {
+  bool ok = true;
+  for (size_t n = 0; n < harts.size(); n++)
+    ok = harts[n]->set_jit(enabled) && ok;
+  return ok;
+}
+
+void hart_group::set_pipeline(const pipeline_config& config) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_pipeline(config);
+}
+
+// Every hart gets caches of its own
+void hart_group::set_caches(const cache_config& icache, const cache_config& dcache) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_caches(icache, dcache);
+}
+
+void hart_group::set_predictor(const predictor_config& config, bool cycles) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_predictor(config, cycles);
+}
+
+void hart_group::set_profile_mix(bool enabled) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_profile_mix(enabled);
+}
+
+void hart_group::set_profiler(uint64_t interval) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_profiler(interval);
+}
+
+void hart_group::set_call_graph(bool enabled) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_call_graph(enabled);
+}
+
+bool hart_group::set_trace(const string& path) {
+  bool ok = true;
+  for (size_t n = 0; n < harts.size(); n++) {
+    string hart_path = path;
+    if (!path.empty() && harts.size() > 1) hart_path += "." + to_string(n);
+    ok = harts[n]->set_trace(hart_path) && ok;
+  }
+  return ok;
+}
+
+void hart_group::set_pc(uint64_t pc) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->set_pc(pc);
+}
+
+// One hart's share of a quantum: catch its view up with the shared memory, then run
+void hart_group::run_hart(unsigned int n) {
+  if (!running[n]) return;
+  views[n]->restore_snapshot(base);
+  harts[n]->execute(quantum_num, quantum_check, quantum_resume);
+}
+
+void hart_group::hart_thread(unsigned int n) {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      unique_lock<mutex> guard(lock);
+      while (round == seen && !stopping) start_quantum.wait(guard);
+      if (stopping) return;
+      seen = round;
+    }
+    run_hart(n);
+    {
+      lock_guard<mutex> guard(lock);
+      if (--pending == 0) quantum_done.notify_one();
+    }
+  }
+}
+
+void hart_group::run_quantum() {
+  // verbose logging isn't safe from more than one thread, and its order should stay fixed anyway
+  if (verbose) {
+    for (unsigned int n = 0; n < harts.size(); n++)
+      run_hart(n);
+    return;
+  }
+
+  if (threads.empty()) {
+    for (unsigned int n = 1; n < harts.size(); n++)
+      threads.push_back(thread(&hart_group::hart_thread, this, n));
+  }
+  {
+    lock_guard<mutex> guard(lock);
+    pending = harts.size() - 1;
+    round++;
+  }
+  start_quantum.notify_all();
+  run_hart(0);
+
+  unique_lock<mutex> guard(lock);
+  while (pending != 0) quantum_done.wait(guard);
+}
+
+void hart_group::execute(unsigned int num, bool breakpoint_check) {
+  if (harts.size() == 1) {
+    harts[0]->execute(num, breakpoint_check);
+    return;
+  }
+
+  running.assign(harts.size(), 1);
+  quantum_check = breakpoint_check;
+  quantum_resume = true;
+  while (num > 0) {
+    quantum_num = num < quantum ? num : quantum;
+    memory::snapshot* start = shared->take_snapshot();
+    base = start;
+    run_quantum();
+
+    // publish what each hart stored, in hart order so a clash always ends the same way
+    for (unsigned int n = 0; n < harts.size(); n++)
+      if (running[n]) shared->merge_changes(*views[n]);
+    shared->free_snapshot(start);
+    base = NULL;
+    num -= quantum_num;
+    quantum_resume = false;
+
+    bool stop = false;
+    bool any_running = false;
+    for (unsigned int n = 0; n < harts.size(); n++) {
+      if (!running[n]) continue;
+      if (harts[n]->stopped_at_breakpoint()) {
+        cout << "Hart " << dec << n << ": Breakpoint reached at "; harts[n]->show_pc();
+        stop = true;
+      }
+      else if (harts[n]->program_ended()) {
+        // as for a single hart, the end of the program leaves a breakpoint at 0
+        cout << "Hart " << dec << n << ": Breakpoint reached at "; harts[n]->show_pc();
+        harts[n]->set_breakpoint(0);
+        running[n] = 0;
+      }
+      any_running = any_running || running[n];
+    }
+    if (stop || !any_running) break;
+  }
+}
+
+hart_group::snapshot* hart_group::take_snapshot() {
+  snapshot* s = new snapshot;
+  for (size_t n = 0; n < harts.size(); n++)
+    s->harts.push_back(harts[n]->take_snapshot(false));
+  s->mem = shared->take_snapshot();
+  return s;
+}
+
+void hart_group::restore_snapshot(const snapshot* s) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->restore_snapshot(s->harts[n]);
+  // the views catch up at the start of the next quantum
+  shared->restore_snapshot(s->mem);
+}
+
+void hart_group::free_snapshot(snapshot* s) {
+  for (size_t n = 0; n < harts.size(); n++)
+    harts[n]->free_snapshot(s->harts[n]);
+  shared->free_snapshot(s->mem);
+  delete s;
+}
+
+uint64_t hart_group::get_instruction_count() {
+  uint64_t total = 0;
+  for (size_t n = 0; n < harts.size(); n++)
+    total += harts[n]->get_instruction_count();
+  return total;
+}
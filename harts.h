@@ -0,0 +1,118 @@
+#ifndef HARTS_H
+#define HARTS_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   A group of harts sharing one memory
+
+**************************************************************** */
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "memory.h"
+#include "processor.h"
+
+using namespace std;
+
+// Instructions each hart runs between synchronisations, unless --quantum says otherwise
+#define DEFAULT_QUANTUM 10000
+
+// With more than one hart, each hart runs on its own host thread against a copy-on-write view of
+// the shared memory. Harts run a quantum at a time. At the barrier after each quantum the bytes every
+// hart stored are copied to the shared memory in hart order, and the next quantum starts from that.
+// No hart sees another's stores until then, so results don't depend on how the host schedules threads.
+// A single hart runs straight on the shared memory, exactly as a lone processor does.
+class hart_group {
+
+ private:
+
+  memory* shared;
+  vector<processor*> harts;
+  vector<memory*> views;            // each hart's view of shared, only with more than one hart
+  unsigned int quantum;
+  unsigned int selected;
+  bool verbose;
+
+  // The quantum being run: who takes part, from which state of the shared memory, and for how long
+  vector<uint8_t> running;
+  const memory::snapshot* base;
+  unsigned int quantum_num;
+  bool quantum_check;
+  bool quantum_resume;
+
+  // Threads for harts 1 and up. Hart 0 runs on the thread calling execute()
+  vector<thread> threads;
+  mutex lock;
+  condition_variable start_quantum;
+  condition_variable quantum_done;
+  uint64_t round;                   // bumped to start each quantum
+  unsigned int pending;             // threads still running the current quantum
+  bool stopping;
+
+  void run_hart(unsigned int n);
+  void hart_thread(unsigned int n);
+  void run_quantum();
+
+ public:
+
+  // Group snapshot: every hart's registers and the shared memory
+  struct snapshot {
+    vector<machine_snapshot*> harts;
+    memory::snapshot* mem;
+  };
+
+  hart_group(memory* shared, unsigned int count, bool verbose, bool stage2, unsigned int quantum);
+  ~hart_group();
+
+  inline unsigned int size() {
+    return harts.size();
+  }
+
+  inline processor* hart(unsigned int n) {
+    return harts[n];
+  }
+
+  // The hart the x, pc, prv, csr and b commands apply to
+  inline processor* current() {
+    return harts[selected];
+  }
+  inline unsigned int get_selected() {
+    return selected;
+  }
+  inline void select(unsigned int n) {
+    selected = n;
+  }
+
+  void set_threaded(bool threaded);
+  bool set_jit(bool enabled);
+  void set_pipeline(const pipeline_config& config);
+  void set_caches(const cache_config& icache, const cache_config& dcache);
+  void set_predictor(const predictor_config& config, bool cycles);
+  void set_profile_mix(bool enabled);
+  void set_profiler(uint64_t interval);
+  void set_call_graph(bool enabled);
+
+  // Trace every hart to path, or to path.n for hart n when there's more than one. An empty path
+  // closes the traces. Returns false if any couldn't be written
+  bool set_trace(const string& path);
+
+  // Start every hart at the same pc, as after loading a program
+  void set_pc(uint64_t pc);
+
+  // Run every hart for num instructions, or until one stops at a breakpoint or all have ended
+  void execute(unsigned int num, bool breakpoint_check);
+
+  snapshot* take_snapshot();
+  void restore_snapshot(const snapshot* s);
+  void free_snapshot(snapshot* s);
+
+  // Instructions executed by all the harts together
+  uint64_t get_instruction_count();
+};
+
+#endif
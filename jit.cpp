@@ -0,0 +1,561 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   x86-64 translator for hot decoded blocks
+
+   Guest registers stay in the processor's reg[] array, addressed off rbx, and the jit::state
+   is addressed off rbp. Each instruction is translated on its own through rax/rcx, and
+   memory accesses call small helpers that go through memory::read_* and write_*, so
+   translated code sees exactly the same memory as the interpreter. Anything that would trap
+   (a misaligned access) leaves translated code before the instruction runs so the
+   interpreter can raise the exception itself.
+
+**************************************************************** */
+
+#include <cstring>
+
+#include "jit.h"
+#include "memory.h"
+#include "Definitions.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+// host registers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define RDI 7
+
+// worst case bytes of host code for one guest instruction, including its exit stubs
+#define MAX_INST_BYTES 208
+
+// ---- Memory helpers called from translated code ----
+
+static uint64_t load_lb(memory* m, uint64_t address) {
+  return (int64_t)(int8_t)(m->read_doubleword(address) >> ((address % 8) * 8));
+}
+
+static uint64_t load_lbu(memory* m, uint64_t address) {
+  return (m->read_doubleword(address) >> ((address % 8) * 8)) & 0xFF;
+}
+
+static uint64_t load_lh(memory* m, uint64_t address) {
+  return (int64_t)(int16_t)(m->read_doubleword(address) >> ((address % 8) * 8));
+}
+
+static uint64_t load_lhu(memory* m, uint64_t address) {
+  return (m->read_doubleword(address) >> ((address % 8) * 8)) & 0xFFFF;
+}
+
+static uint64_t load_lw(memory* m, uint64_t address) {
+  return (int64_t)(int32_t)m->read_word(address);
+}
+
+static uint64_t load_lwu(memory* m, uint64_t address) {
+  return m->read_word(address);
+}
+
+static uint64_t load_ld(memory* m, uint64_t address) {
+  return m->read_doubleword(address);
+}
+
+// stores hand back the code generation so translated code can tell if it just overwrote itself
+static uint64_t store_sb(memory* m, uint64_t address, uint64_t data) {
+  m->write_byte(address, data, 0xFF);
+  return m->get_code_generation();
+}
+
+static uint64_t store_sh(memory* m, uint64_t address, uint64_t data) {
+  m->write_half(address, data, 0xFFFF);
+  return m->get_code_generation();
+}
+
+static uint64_t store_sw(memory* m, uint64_t address, uint64_t data) {
+  m->write_word(address, data, ~0UL);
+  return m->get_code_generation();
+}
+
+static uint64_t store_sd(memory* m, uint64_t address, uint64_t data) {
+  m->write_doubleword(address, data, ~0ULL);
+  return m->get_code_generation();
+}
+
+static inline bool fits_int32(int64_t value) {
+  return (int64_t)(int32_t)value == value;
+}
+
+jit::jit() {
+  buffer = NULL;
+  used = 0;
+  code = NULL;
+  exit_stub = NULL;
+  trampoline = NULL;
+  is_full = false;
+  memset(&st, 0, sizeof(st));
+
+#ifdef JIT_SUPPORTED
+  void* mapped = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped != MAP_FAILED) {
+    buffer = (uint8_t*)mapped;
+    reset();
+  }
+#endif
+}
+
+jit::~jit() {
+#ifdef JIT_SUPPORTED
+  if (buffer != NULL) munmap(buffer, JIT_BUFFER_SIZE);
+#endif
+}
+
+bool jit::available() {
+  return buffer != NULL;
+}
+
+bool jit::full() {
+  return is_full;
+}
+
+void jit::reset() {
+  entries.clear();
+  pending_links.clear();
+  is_full = false;
+  code = buffer;
+  emit_prologue();
+  used = code - buffer;
+}
+
+void jit::run(void* entry) {
+  trampoline(&st, entry);
+}
+
+// ---- Emitter ----
+
+void jit::emit8(uint8_t byte) {
+  *code++ = byte;
+}
+
+void jit::emit32(uint32_t word) {
+  memcpy(code, &word, 4);
+  code += 4;
+}
+
+void jit::emit64(uint64_t dword) {
+  memcpy(code, &dword, 8);
+  code += 8;
+}
+
+// mov host, [rbx + 8*guest]. x0 is always zero so it is never loaded
+void jit::load_reg(int host, int guest) {
+  if (guest == 0) {
+    emit8(0x31); emit8(0xC0 | host << 3 | host);  // xor host32, host32
+    return;
+  }
+  emit8(0x48); emit8(0x8B); emit8(0x80 | host << 3 | RBX); emit32(8 * guest);
+}
+
+// mov [rbx + 8*guest], host. Writes to x0 are dropped
+void jit::store_reg(int host, int guest) {
+  if (guest == 0) return;
+  emit8(0x48); emit8(0x89); emit8(0x80 | host << 3 | RBX); emit32(8 * guest);
+}
+
+// mov host, imm
+void jit::load_imm(int host, int64_t value) {
+  if (fits_int32(value)) {
+    emit8(0x48); emit8(0xC7); emit8(0xC0 | host); emit32((uint32_t)value);
+  } else {
+    emit8(0x48); emit8(0xB8 + host); emit64((uint64_t)value);
+  }
+}
+
+// mov host, [rbp + offset]
+void jit::load_state(int host, size_t offset) {
+  emit8(0x48); emit8(0x8B); emit8(0x80 | host << 3 | RBP); emit32(offset);
+}
+
+// mov [rbp + offset], host
+void jit::store_state(int host, size_t offset) {
+  emit8(0x48); emit8(0x89); emit8(0x80 | host << 3 | RBP); emit32(offset);
+}
+
+// mov rax, function; call rax
+void jit::call(void* function) {
+  emit8(0x48); emit8(0xB8); emit64((uint64_t)(uintptr_t)function);
+  emit8(0xFF); emit8(0xD0);
+}
+
+// Emit a jmp (opcode_prefix 0) or jcc with a rel32 operand, returning where the operand is
+uint8_t* jit::jump32(uint8_t opcode_prefix, uint8_t opcode) {
+  if (opcode_prefix) emit8(opcode_prefix);
+  emit8(opcode);
+  uint8_t* site = code;
+  emit32(0);
+  return site;
+}
+
+void jit::patch32(uint8_t* site, uint8_t* target) {
+  int32_t rel = (int32_t)(target - (site + 4));
+  memcpy(site, &rel, 4);
+}
+
+// Leave for target. A linkable exit is later patched to jump straight into target's translation
+void jit::exit_to(uint64_t target, bool linkable) {
+  load_imm(RAX, target);
+  store_state(RAX, offsetof(state, pc));
+  uint8_t* site = jump32(0, 0xE9);
+
+  auto entry = entries.find(target);
+  if (linkable && entry != entries.end()) {
+    patch32(site, entry->second);
+  } else {
+    patch32(site, exit_stub);
+    if (linkable) pending_links[target].push_back(site);
+  }
+}
+
+// Add the timing model's counts for the instructions after before (NULL for the start of the block)
+// up to and including upto, or take them back again
+void jit::count_stalls(const decoded_inst* before, const decoded_inst& upto, bool give_back) {
+  int counts[4][2] = {
+    { rv64::load_stall, upto.loads - (before ? before->loads : 0) },
+    { rv64::store_stall, upto.stores - (before ? before->stores : 0) },
+    { rv64::load_use_stall, upto.load_uses - (before ? before->load_uses : 0) },
+    { rv64::jump_stall, upto.jumps - (before ? before->jumps : 0) }
+  };
+  for (int i = 0; i < 4; i++) {
+    if (counts[i][1] == 0) continue;
+    // add/sub qword [rbp + stalls[reason]], n
+    emit8(0x48); emit8(0x81); emit8(give_back ? 0xAD : 0x85);
+    emit32(offsetof(state, stalls) + 8 * counts[i][0]); emit32(counts[i][1]);
+  }
+}
+
+// void trampoline(state* st, void* entry): save what we use, point rbp at st and rbx at the
+// register file, then jump to entry. Blocks leave through exit_stub, which undoes all of it
+void jit::emit_prologue() {
+  emit8(0x53);                                  // push rbx
+  emit8(0x55);                                  // push rbp
+  emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);  // sub rsp, 8 (keep calls 16 byte aligned)
+  emit8(0x48); emit8(0x89); emit8(0xFD);        // mov rbp, rdi
+  load_state(RBX, offsetof(state, regs));
+  emit8(0xFF); emit8(0xE6);                     // jmp rsi
+
+  exit_stub = code;
+  emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);  // add rsp, 8
+  emit8(0x5D);                                  // pop rbp
+  emit8(0x5B);                                  // pop rbx
+  emit8(0xC3);                                  // ret
+
+  trampoline = (void (*)(state*, void*))(uintptr_t)buffer;
+}
+
+bool jit::translatable(const decoded_inst& di) {
+  switch (di.kind) {
+    case rv64::ecall_k:
+    case rv64::ebreak_k:
+    case rv64::mret_k:
+    case rv64::csrrw_k:
+    case rv64::csrrs_k:
+    case rv64::csrrc_k:
+    case rv64::csrrwi_k:
+    case rv64::csrrsi_k:
+    case rv64::csrrci_k:
+    case rv64::illegal_k:
+      return false;
+
+    case rv64::jalr_k:
+      // jalr x0, 0(x0) ends the program, leave that to the interpreter
+      return !(di.rd == 0 && di.rs1 == 0 && di.imm == 0);
+
+    default:
+      return true;
+  }
+}
+
+// Translate one instruction. index places it in the block so exits can give back the
+// budget of the instructions that didn't run
+bool jit::emit_inst(const decoded_inst& di, uint64_t inst_pc, size_t index,
+                    vector<pair<uint8_t*, size_t> >& trap_exits, vector<pair<uint8_t*, size_t> >& code_exits) {
+  uint8_t alu_op = 0;
+  uint8_t shift_op = 0;
+  uint8_t align_mask = 0;
+  void* helper = NULL;
+  uint8_t jcc = 0;
+
+  switch (di.kind) {
+    case rv64::lui_k:
+      if (di.rd == 0) break;
+      load_imm(RAX, di.imm);
+      store_reg(RAX, di.rd);
+    break;
+
+    case rv64::auipc_k:
+      if (di.rd == 0) break;
+      load_imm(RAX, inst_pc + di.imm);
+      store_reg(RAX, di.rd);
+    break;
+
+    // reg-imm and reg-reg ALU ops share everything but where rcx comes from
+    case rv64::addi_k: case rv64::add_k: alu_op = 0x01; goto alu;
+    case rv64::xori_k: case rv64::xor_k: alu_op = 0x31; goto alu;
+    case rv64::ori_k:  case rv64::or_k:  alu_op = 0x09; goto alu;
+    case rv64::andi_k: case rv64::and_k: alu_op = 0x21; goto alu;
+    case rv64::sub_k:                    alu_op = 0x29; goto alu;
+    alu:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      if (di.kind == rv64::add_k || di.kind == rv64::xor_k || di.kind == rv64::or_k ||
+          di.kind == rv64::and_k || di.kind == rv64::sub_k) {
+        load_reg(RCX, di.rs2);
+      } else {
+        load_imm(RCX, di.imm);
+      }
+      emit8(0x48); emit8(alu_op); emit8(0xC8);  // op rax, rcx
+      store_reg(RAX, di.rd);
+    break;
+
+    case rv64::slti_k: case rv64::slt_k:   jcc = 0x9C; goto set;  // setl
+    case rv64::sltiu_k: case rv64::sltu_k: jcc = 0x92; goto set;  // setb
+    set:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      if (di.kind == rv64::slt_k || di.kind == rv64::sltu_k) {
+        load_reg(RCX, di.rs2);
+      } else {
+        load_imm(RCX, di.imm);
+      }
+      emit8(0x48); emit8(0x39); emit8(0xC8);    // cmp rax, rcx
+      emit8(0x0F); emit8(jcc); emit8(0xC0);     // setcc al
+      emit8(0x0F); emit8(0xB6); emit8(0xC0);    // movzx eax, al
+      store_reg(RAX, di.rd);
+    break;
+
+    case rv64::slli_k: shift_op = 0xE0; goto shift_imm;
+    case rv64::srli_k: shift_op = 0xE8; goto shift_imm;
+    case rv64::srai_k: shift_op = 0xF8; goto shift_imm;
+    shift_imm:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      emit8(0x48); emit8(0xC1); emit8(shift_op); emit8(di.rs2);  // shift rax, shamt
+      store_reg(RAX, di.rd);
+    break;
+
+    // x86 masks 64 bit shift counts to 6 bits, just like RV64
+    case rv64::sll_k: shift_op = 0xE0; goto shift_reg;
+    case rv64::srl_k: shift_op = 0xE8; goto shift_reg;
+    case rv64::sra_k: shift_op = 0xF8; goto shift_reg;
+    shift_reg:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      load_reg(RCX, di.rs2);
+      emit8(0x48); emit8(0xD3); emit8(shift_op);  // shift rax, cl
+      store_reg(RAX, di.rd);
+    break;
+
+    // W ops work on eax and sign extend the result
+    case rv64::addiw_k:
+    case rv64::addw_k:
+    case rv64::subw_k:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      if (di.kind == rv64::addiw_k) load_imm(RCX, di.imm);
+      else load_reg(RCX, di.rs2);
+      emit8(di.kind == rv64::subw_k ? 0x29 : 0x01); emit8(0xC8);  // add/sub eax, ecx
+      emit8(0x48); emit8(0x63); emit8(0xC0);                      // movsxd rax, eax
+      store_reg(RAX, di.rd);
+    break;
+
+    case rv64::slliw_k: shift_op = 0xE0; goto shift_imm32;
+    case rv64::srliw_k: shift_op = 0xE8; goto shift_imm32;
+    case rv64::sraiw_k: shift_op = 0xF8; goto shift_imm32;
+    shift_imm32:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      emit8(0xC1); emit8(shift_op); emit8(di.rs2);  // shift eax, shamt
+      emit8(0x48); emit8(0x63); emit8(0xC0);        // movsxd rax, eax
+      store_reg(RAX, di.rd);
+    break;
+
+    // and 32 bit shift counts to 5 bits, like the RV64 W ops
+    case rv64::sllw_k: shift_op = 0xE0; goto shift_reg32;
+    case rv64::srlw_k: shift_op = 0xE8; goto shift_reg32;
+    case rv64::sraw_k: shift_op = 0xF8; goto shift_reg32;
+    shift_reg32:
+      if (di.rd == 0) break;
+      load_reg(RAX, di.rs1);
+      load_reg(RCX, di.rs2);
+      emit8(0xD3); emit8(shift_op);                 // shift eax, cl
+      emit8(0x48); emit8(0x63); emit8(0xC0);        // movsxd rax, eax
+      store_reg(RAX, di.rd);
+    break;
+
+    case rv64::fence_k:
+    break;
+
+    case rv64::lb_k:  helper = (void*)(uintptr_t)&load_lb;  goto load;
+    case rv64::lbu_k: helper = (void*)(uintptr_t)&load_lbu; goto load;
+    case rv64::lh_k:  helper = (void*)(uintptr_t)&load_lh;  align_mask = 1; goto load;
+    case rv64::lhu_k: helper = (void*)(uintptr_t)&load_lhu; align_mask = 1; goto load;
+    case rv64::lw_k:  helper = (void*)(uintptr_t)&load_lw;  align_mask = 3; goto load;
+    case rv64::lwu_k: helper = (void*)(uintptr_t)&load_lwu; align_mask = 3; goto load;
+    case rv64::ld_k:  helper = (void*)(uintptr_t)&load_ld;  align_mask = 7; goto load;
+    load:
+      load_reg(RAX, di.rs1);
+      load_imm(RCX, di.imm);
+      emit8(0x48); emit8(0x01); emit8(0xC8);        // add rax, rcx
+      if (align_mask) {
+        emit8(0xA8); emit8(align_mask);             // test al, mask
+        trap_exits.push_back(make_pair(jump32(0x0F, 0x85), index));  // jnz
+      }
+      emit8(0x48); emit8(0x89); emit8(0xC6);        // mov rsi, rax
+      load_state(RDI, offsetof(state, mem));
+      call(helper);
+      store_reg(RAX, di.rd);
+    break;
+
+    case rv64::sb_k: helper = (void*)(uintptr_t)&store_sb; goto store;
+    case rv64::sh_k: helper = (void*)(uintptr_t)&store_sh; align_mask = 1; goto store;
+    case rv64::sw_k: helper = (void*)(uintptr_t)&store_sw; align_mask = 3; goto store;
+    case rv64::sd_k: helper = (void*)(uintptr_t)&store_sd; align_mask = 7; goto store;
+    store:
+      load_reg(RAX, di.rs1);
+      load_imm(RCX, di.imm);
+      emit8(0x48); emit8(0x01); emit8(0xC8);        // add rax, rcx
+      if (align_mask) {
+        emit8(0xA8); emit8(align_mask);             // test al, mask
+        trap_exits.push_back(make_pair(jump32(0x0F, 0x85), index));  // jnz
+      }
+      emit8(0x48); emit8(0x89); emit8(0xC6);        // mov rsi, rax
+      load_reg(RDX, di.rs2);
+      load_state(RDI, offsetof(state, mem));
+      call(helper);
+      emit8(0x48); emit8(0x3B); emit8(0x85); emit32(offsetof(state, code_generation));  // cmp rax, [rbp + code_generation]
+      code_exits.push_back(make_pair(jump32(0x0F, 0x85), index));  // jne
+    break;
+
+    case rv64::jal_k:
+      if (di.rd != 0) {
+        load_imm(RAX, inst_pc + 4);
+        store_reg(RAX, di.rd);
+      }
+      exit_to((inst_pc + di.imm) & ~1ULL, true);
+    break;
+
+    case rv64::jalr_k:
+      load_reg(RAX, di.rs1);
+      load_imm(RCX, di.imm);
+      emit8(0x48); emit8(0x01); emit8(0xC8);        // add rax, rcx
+      emit8(0x48); emit8(0x83); emit8(0xE0); emit8(0xFE);  // and rax, -2
+      if (di.rd != 0) {
+        load_imm(RCX, inst_pc + 4);
+        store_reg(RCX, di.rd);
+      }
+      store_state(RAX, offsetof(state, pc));
+      patch32(jump32(0, 0xE9), exit_stub);
+    break;
+
+    case rv64::beq_k:  jcc = 0x84; goto branch;
+    case rv64::bne_k:  jcc = 0x85; goto branch;
+    case rv64::blt_k:  jcc = 0x8C; goto branch;
+    case rv64::bge_k:  jcc = 0x8D; goto branch;
+    case rv64::bltu_k: jcc = 0x82; goto branch;
+    case rv64::bgeu_k: jcc = 0x83; goto branch;
+    branch: {
+      load_reg(RAX, di.rs1);
+      load_reg(RCX, di.rs2);
+      emit8(0x48); emit8(0x39); emit8(0xC8);        // cmp rax, rcx
+      uint8_t* taken = jump32(0x0F, jcc);
+      exit_to(inst_pc + 4, true);
+      patch32(taken, code);
+      if (di.imm != 4) {
+        // inc qword [rbp + stalls[branch]]
+        emit8(0x48); emit8(0xFF); emit8(0x85); emit32(offsetof(state, stalls) + 8 * rv64::branch_stall);
+      }
+      exit_to(inst_pc + di.imm, true);
+    }
+    break;
+
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+void* jit::compile(const decoded_block& block) {
+  if (buffer == NULL) return NULL;
+
+  // translate up to the first instruction the interpreter has to run
+  size_t count = 0;
+  while (count < block.insts.size() && translatable(block.insts[count])) count++;
+  if (count == 0) return NULL;
+
+  if (used + (count + 2) * MAX_INST_BYTES > JIT_BUFFER_SIZE) {
+    is_full = true;
+    return NULL;
+  }
+
+  code = buffer + used;
+  uint8_t* entry = code;
+  uint64_t start = block.start_pc;
+  vector<pair<uint8_t*, size_t> > trap_exits;
+  vector<pair<uint8_t*, size_t> > code_exits;
+
+  // don't start if the budget won't cover the whole block. Otherwise take it all up front
+  emit8(0x48); emit8(0x81); emit8(0xBD); emit32(offsetof(state, budget)); emit32(count);  // cmp qword [rbp + budget], count
+  uint8_t* bail_budget = jump32(0x0F, 0x8C);        // jl
+  emit8(0x48); emit8(0x81); emit8(0xAD); emit32(offsetof(state, budget)); emit32(count);  // sub qword [rbp + budget], count
+  count_stalls(NULL, block.insts[count - 1], false);
+
+  bool ended = false;
+  for (size_t i = 0; i < count; i++) {
+    const decoded_inst& di = block.insts[i];
+    emit_inst(di, start + 4*i, i, trap_exits, code_exits);
+    ended = (di.kind >= rv64::jal_k && di.kind <= rv64::bgeu_k);
+  }
+  if (!ended) exit_to(start + 4*count, true);
+
+  // not started at all
+  patch32(bail_budget, code);
+  exit_to(start, false);
+
+  // about to trap: hand back the budget of everything from this instruction on
+  for (size_t i = 0; i < trap_exits.size(); i++) {
+    patch32(trap_exits[i].first, code);
+    emit8(0x48); emit8(0x81); emit8(0x85); emit32(offsetof(state, budget)); emit32(count - trap_exits[i].second);  // add qword [rbp + budget], n
+    size_t index = trap_exits[i].second;
+    count_stalls(index > 0 ? &block.insts[index - 1] : NULL, block.insts[count - 1], true);
+    exit_to(start + 4*trap_exits[i].second, false);
+  }
+
+  // stored over decoded code: leave right after the store
+  for (size_t i = 0; i < code_exits.size(); i++) {
+    patch32(code_exits[i].first, code);
+    emit8(0x48); emit8(0x81); emit8(0x85); emit32(offsetof(state, budget)); emit32(count - code_exits[i].second - 1);  // add qword [rbp + budget], n
+    count_stalls(&block.insts[code_exits[i].second], block.insts[count - 1], true);
+    exit_to(start + 4*code_exits[i].second + 4, false);
+  }
+
+  // now anything that was waiting for this block can jump straight in
+  entries[start] = entry;
+  auto waiting = pending_links.find(start);
+  if (waiting != pending_links.end()) {
+    for (size_t i = 0; i < waiting->second.size(); i++) {
+      patch32(waiting->second[i], entry);
+    }
+    pending_links.erase(waiting);
+  }
+
+  used = code - buffer;
+  return entry;
+}
@@ -0,0 +1,102 @@
+#ifndef JIT_H
+#define JIT_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   x86-64 translator for hot decoded blocks
+
+**************************************************************** */
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+
+#include "block_cache.h"
+#include "pipeline.h"
+
+using namespace std;
+
+class memory;
+
+// Executions of a decoded block before it is translated
+#define JIT_THRESHOLD 50
+
+// Size of the executable code buffer. When it fills up everything is thrown away and retranslated
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+
+class jit {
+
+ public:
+
+  // Everything translated code reads or writes apart from the register file.
+  // Translated code reaches it through a host register, so the layout is part of the code
+  struct state {
+    uint64_t* regs;
+    memory* mem;
+    uint64_t pc;                // next guest pc when translated code returns
+    int64_t budget;             // instructions left to run, blocks won't start unless all of theirs fit
+    uint64_t code_generation;   // a store that changes this leaves translated code
+    uint64_t stalls[rv64::num_stalls];  // timing model counts, added to the processor's on return
+  };
+
+  state st;
+
+ private:
+
+  uint8_t* buffer;
+  size_t used;
+  bool is_full;
+  uint8_t* code;              // emit position
+  uint8_t* exit_stub;         // shared epilogue every block returns through
+  void (*trampoline)(state*, void*);
+
+  // Translated block entries, and jumps waiting for a block to be translated
+  unordered_map<uint64_t, uint8_t*> entries;
+  unordered_map<uint64_t, vector<uint8_t*> > pending_links;
+
+  // emitter
+  void emit8(uint8_t byte);
+  void emit32(uint32_t word);
+  void emit64(uint64_t dword);
+  void load_reg(int host, int guest);
+  void store_reg(int host, int guest);
+  void load_imm(int host, int64_t value);
+  void load_state(int host, size_t offset);
+  void store_state(int host, size_t offset);
+  void call(void* function);
+  uint8_t* jump32(uint8_t opcode_prefix, uint8_t opcode);
+  void patch32(uint8_t* site, uint8_t* target);
+  void exit_to(uint64_t target, bool linkable);
+  void emit_prologue();
+  void count_stalls(const decoded_inst* before, const decoded_inst& upto, bool give_back);
+  bool emit_inst(const decoded_inst& di, uint64_t inst_pc, size_t index,
+                 vector<pair<uint8_t*, size_t> >& trap_exits, vector<pair<uint8_t*, size_t> >& code_exits);
+
+ public:
+
+  jit();
+  ~jit();
+
+  // False if there is no executable buffer (or no translator for this host)
+  bool available();
+
+  // True if an instruction kind can be translated, anything else ends the translated part of a block
+  static bool translatable(const decoded_inst& di);
+
+  // Translate a block. Returns the entry point, or NULL if nothing in the block can be translated
+  // or the buffer is full (check full() and reset())
+  void* compile(const decoded_block& block);
+
+  bool full();
+
+  // Drop all translated code
+  void reset();
+
+  // Run translated code from entry until it leaves to the interpreter
+  void run(void* entry);
+};
+
+#endif
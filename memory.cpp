@@ -12,75 +12,252 @@
 #include <stdlib.h>
 #include <cstdio>
 #include <cstring>
+#include <cctype>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "memory.h"
+#include "cache.h"
 using namespace std;
 
 #include "LogControl.h"
 
-#define validate(address) \
-  index = address/blockSize; \
-  auto temp_find = mem_m.find(index); \
-  if (index == cached_block_index) { \
-    block = cached_block_addr; \
-  } \
-  else if (temp_find == mem_m.end()) { \
-    block = (uintptr_t)malloc(blockSize); \
-    mem_m[index] = block; \
-    cached_block_index = index; \
-    cached_block_addr = block; \
+// Addresses inside the RAM region only need a subtract and a compare, then the TLB is tried.
+// Anything else is a miss: the RAM region when it is being logged, or a walk of the page table.
+// The region is page aligned, so block + address % blockSize works the same for every path.
+#define lookup(address, t, set_code, find) \
+  index = address - ram_base; \
+  if (index < ram_fast_size) { \
+    block = (uintptr_t)ram + index - (index % blockSize); \
+    set_code(&ram_code[index / blockSize]); \
+  } else if (t.entry[(address/blockSize) % TLB_ENTRIES].index == address/blockSize) { \
+    t.hits++; \
+    pg = t.entry[(address/blockSize) % TLB_ENTRIES].pg; \
+    block = (uintptr_t)pg->data; \
+    set_code(&pg->code); \
   } else { \
-    block = temp_find->second; \
-    cached_block_index = index; \
-    cached_block_addr = block; \
+    missed = true; \
+    t.misses++; \
+    if (index < ram_size) { \
+      block = (uintptr_t)ram + index - (index % blockSize); \
+      set_code(&ram_code[index / blockSize]); \
+    } else { \
+      index = address/blockSize; \
+      pg = find(index); \
+      if (!log_accesses) { \
+        t.entry[index % TLB_ENTRIES].index = index; \
+        t.entry[index % TLB_ENTRIES].pg = pg; \
+      } \
+      block = (uintptr_t)pg->data; \
+      set_code(&pg->code); \
+    } \
   }
 //
 
-// #define validate(address) \
-//   index = address/blockSize; \
-//   if (mem_m.find(index) == mem_m.end()) { \
-//     block = (uintptr_t)malloc(blockSize); \
-//     mem_m[index] = block; \
-//   } else { \
-//     block = mem_m[index]; \
-//   }
-//
+#define no_code(flag)
+#define store_code(flag) code = (flag)
 
-#define validate_with_memset(address) \
-  index = address/blockSize; \
-  auto temp_find = mem_m.find(index); \
-  if (index == cached_block_index) { \
-    block = cached_block_addr; \
-  } \
-  else if (temp_find == mem_m.end()) { \
-    block = (uintptr_t)malloc(blockSize); \
-    memset((void*)block, 0, blockSize); \
-    mem_m[index] = block; \
-    cached_block_index = index; \
-    cached_block_addr = block; \
-  } else { \
-    block = temp_find->second; \
-    cached_block_index = index; \
-    cached_block_addr = block; \
-  }
+#define validate(address, t) lookup(address, t, no_code, find_page)
+
+// Stores also need the page's code flag, and a page of their own if a snapshot shares it.
+// New pages always come back zeroed
+#define validate_store(address, t) lookup(address, t, store_code, find_writable_page)
 //
 
-// #define validate_with_memset(address) \
-//   index = address/blockSize; \
-//   if (mem_m.find(index) == mem_m.end()) { \
-//     block = (uintptr_t)malloc(blockSize); \
-//     memset((void*)block, 0, blockSize); \
-//     mem_m[index] = block; \
-//   } else { \
-//     block = mem_m[index]; \
-//   }
+// Verbose logging of every access. While accesses are logged the TLBs stay empty and the RAM region
+// skips its fast path, so only a miss has to check, and the message is built out of line
+#ifdef LOGGING_ENABLED
+#define log_read(what, address, data) if (missed && log_accesses) log_access(what, address, data)
+#define log_write(what, address, data, mask) if (missed && log_accesses) log_access(what, address, data, mask)
+#else
+#define log_read(what, address, data) (void)missed
+#define log_write(what, address, data, mask) (void)missed
+#endif
 //
 
+void memory::log_access(const char* what, uint64_t address, uint64_t data) {
+  vlog(what << ": address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << data);
+}
+
+void memory::log_access(const char* what, uint64_t address, uint64_t data, uint64_t mask) {
+  vlog(what << ": address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << data << ", mask = " << mask);
+}
+
 // Constructor
-memory::memory(bool verbose) : mem_m() {
+memory::memory(bool verbose) {
   this->verbose = verbose;
-  cached_block_index = -1;
-  cached_block_addr = 0x00;
+  memset(&root, 0, sizeof(root));
+  node_count = 0;
+  page_count = 0;
+  tlb_reset(fetch_tlb);
+  tlb_reset(read_tlb);
+  tlb_reset(write_tlb);
+  code_generation = 0;
+  ram = NULL;
+  ram_code = NULL;
+  ram_base = 0;
+  ram_size = 0;
+  ram_fast_size = 0;
+  dcache = NULL;
+  track_stores = false;
+#ifdef LOGGING_ENABLED
+  log_accesses = verbose;
+#else
+  log_accesses = false;
+#endif
+}
+
+// Back [base, base + size) with one anonymous mapping. The OS zero fills it on demand
+bool memory::map_ram(uint64_t base, uint64_t size) {
+  if (ram != NULL || size == 0 || base % blockSize != 0 || size % blockSize != 0 || base + size < base)
+    return false;
+  void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED)
+    return false;
+#ifdef MADV_HUGEPAGE
+  madvise(region, size, MADV_HUGEPAGE);
+#endif
+  ram = (uint8_t*)region;
+  ram_code = (bool*)calloc(size / blockSize, sizeof(bool));
+  ram_base = base;
+  ram_size = size;
+  ram_fast_size = log_accesses ? 0 : size;
+  tlb_flush();
+  return true;
+}
+
+// Walk the page table to the slot for index: the one holding its page, or the empty one it belongs in.
+// A page is stored in the first empty slot on its path; when another page already holds that slot,
+// the old page is pushed down into a new node and the walk carries on from there. Two page numbers
+// always part ways by the last level.
+uintptr_t* memory::find_slot(uint64_t index) {
+  int shift = (radixLevels - 1) * radixBits;
+  uintptr_t* slot = &root.slot[(index >> shift) & (radixFanout - 1)];
+  while (true) {
+    uintptr_t entry = *slot;
+    if (entry == 0)
+      return slot;
+    if (entry & 1) {
+      page* pg = (page*)(entry & ~(uintptr_t)1);
+      if (pg->index == index)
+        return slot;
+      radix_node* node = (radix_node*)calloc(1, sizeof(radix_node));
+      node_count++;
+      node->slot[(pg->index >> (shift - radixBits)) & (radixFanout - 1)] = entry;
+      *slot = (uintptr_t)node;
+      entry = (uintptr_t)node;
+    }
+    shift -= radixBits;
+    slot = &((radix_node*)entry)->slot[(index >> shift) & (radixFanout - 1)];
+  }
+}
+
+// A snapshot can be restored into another memory running on another thread, so page reference counts
+// and the code flag of a page that might be shared are only touched atomically
+#define page_ref(pg) __atomic_add_fetch(&(pg)->refs, 1, __ATOMIC_RELAXED)
+#define page_unref(pg) __atomic_sub_fetch(&(pg)->refs, 1, __ATOMIC_ACQ_REL)
+#define page_shared(pg) (__atomic_load_n(&(pg)->refs, __ATOMIC_ACQUIRE) != 1)
+
+memory::page* memory::find_page(uint64_t index) {
+  uintptr_t* slot = find_slot(index);
+  if (*slot != 0)
+    return (page*)(*slot & ~(uintptr_t)1);
+  page* pg = (page*)calloc(1, sizeof(page));
+  pg->index = index;
+  pg->refs = 1;
+  page_count++;
+  *slot = (uintptr_t)pg | 1;
+  // Pages only move when copied for a store, so a new page can't leave a stale TLB entry behind
+  return pg;
+}
+
+memory::page* memory::find_writable_page(uint64_t index) {
+  uintptr_t* slot = find_slot(index);
+  if (*slot == 0)
+    return find_page(index);
+  page* pg = (page*)(*slot & ~(uintptr_t)1);
+  if (!page_shared(pg))
+    return pg;
+
+  // shared with a snapshot, which keeps the original
+  page* copy = (page*)malloc(sizeof(page));
+  copy->index = index;
+  copy->code = __atomic_load_n(&pg->code, __ATOMIC_RELAXED);
+  copy->refs = 1;
+  copy->stored = NULL;
+  memcpy(copy->data, pg->data, blockSize);
+  page_count++;
+  page_unref(pg);
+  *slot = (uintptr_t)copy | 1;
+
+  // loads and fetches may still be going to the shared page
+  tlb* tlbs[] = {&fetch_tlb, &read_tlb, &write_tlb};
+  for (int i = 0; i < 3; i++)
+    if (tlbs[i]->entry[index % TLB_ENTRIES].index == index)
+      tlbs[i]->entry[index % TLB_ENTRIES].index = ~0ULL;
+  return copy;
+}
+
+void memory::insert_page(page* pg) {
+  *find_slot(pg->index) = (uintptr_t)pg | 1;
+  page_ref(pg);
+}
+
+void memory::release_page(page* pg) {
+  if (page_unref(pg) == 0) {
+    free(pg->stored);
+    free(pg);
+    page_count--;
+  }
+}
+
+// Slots are visited in order and the top bits of the page number pick the slot at the root,
+// so pages come out in page number order
+void memory::collect_pages(radix_node* node, vector<uintptr_t*>& slots) {
+  for (int i = 0; i < radixFanout; i++) {
+    if (node->slot[i] & 1)
+      slots.push_back(&node->slot[i]);
+    else if (node->slot[i])
+      collect_pages((radix_node*)node->slot[i], slots);
+  }
+}
+
+void memory::tlb_reset(tlb& t) {
+  memset(t.entry, 0xff, sizeof(t.entry));
+  t.hits = 0;
+  t.misses = 0;
+}
+
+// Drop every TLB entry, keeping the counts
+void memory::tlb_flush() {
+  memset(fetch_tlb.entry, 0xff, sizeof(fetch_tlb.entry));
+  memset(read_tlb.entry, 0xff, sizeof(read_tlb.entry));
+  memset(write_tlb.entry, 0xff, sizeof(write_tlb.entry));
+}
+
+// Flag the page containing address as holding decoded instructions
+void memory::mark_code(uint64_t address) {
+  if (address - ram_base < ram_size)
+    ram_code[(address - ram_base) / blockSize] = true;
+  else
+    __atomic_store_n(&find_page(address/blockSize)->code, true, __ATOMIC_RELAXED);
+}
+
+// A store hit a code page: unflag it and tell the processor its decoded copy is stale
+void memory::code_block_written(bool* code) {
+  *code = false;
+  code_generation++;
+}
+
+// Note the bytes a store of bytes bytes at offset in pg wrote: those with a non-zero byte of mask
+void memory::mark_stored(page* pg, uint64_t offset, unsigned int bytes, uint64_t mask) {
+  if (pg->stored == NULL)
+    pg->stored = (uint64_t*)calloc(blockSize / 64, sizeof(uint64_t));
+  for (unsigned int i = 0; i < bytes && offset + i < blockSize; i++)
+    if ((mask >> (8*i)) & 0xff)
+      pg->stored[(offset + i) / 64] |= 1ULL << ((offset + i) % 64);
 }
 
 // Read a doubleword of data from a doubleword-aligned address.
@@ -91,9 +268,12 @@ uint64_t memory::read_doubleword (uint64_t address) {
 
   uint64_t index;
   uintptr_t block;
-  validate(address);
+  page* pg;
+  bool missed = false;
+  validate(address, read_tlb);
+  if (dcache != NULL) dcache->access(address, false);
 
-  vlog("Memory read doubleword: address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << *reinterpret_cast< uint64_t* > (block + (address % blockSize)));
+  log_read("Memory read doubleword", address, *reinterpret_cast< uint64_t* > (block + (address % blockSize)));
   return *reinterpret_cast< uint64_t* > (block + (address % blockSize));
 }
 
@@ -101,10 +281,27 @@ uint32_t memory::read_word (uint64_t address) {
 
   uint64_t index;
   uintptr_t block;
-  validate(address);
+  page* pg;
+  bool missed = false;
+  validate(address, read_tlb);
+  if (dcache != NULL) dcache->access(address, false);
   
 
-  vlog("Memory read word: address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << *reinterpret_cast< uint64_t* > (block + (address % blockSize)));
+  log_read("Memory read word", address, *reinterpret_cast< uint64_t* > (block + (address % blockSize)));
+  return *reinterpret_cast< uint32_t* > (block + (address % blockSize));
+}
+
+uint32_t memory::fetch_word (uint64_t address) {
+
+  uint64_t index;
+  uintptr_t block;
+  page* pg;
+  bool missed = false;
+  validate(address, fetch_tlb);
+
+  // logged as the doubleword read fetches used to be, so -v output matches the reference logs
+  log_read("Memory read doubleword", address & ~(uint64_t)7,
+           *reinterpret_cast< uint64_t* > (block + (address % blockSize & ~(uint64_t)7)));
   return *reinterpret_cast< uint32_t* > (block + (address % blockSize));
 }
 
@@ -117,148 +314,435 @@ void memory::write_doubleword (uint64_t address, uint64_t data, uint64_t mask) {
 
   uint64_t index;
   uintptr_t block;
-  validate_with_memset(address);
+  page* pg;
+  bool missed = false;
+  bool* code;
+  validate_store(address, write_tlb);
+  if (dcache != NULL) dcache->access(address, true);
 
   uint64_t* dw = reinterpret_cast< uint64_t* > (block + (address % blockSize));
   *dw = (*dw & ~mask) | (data & mask);
-  vlog("Memory doublewrite word: address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << data << ", mask = " << mask);
+  if (*code) code_block_written(code);
+  if (track_stores) mark_stored(pg, address % blockSize, 8, mask);
+  log_write("Memory doublewrite word", address, data, mask);
 }
 
 void memory::write_word (uint64_t address, uint64_t data, uint64_t mask) { 
 
   uint64_t index;
   uintptr_t block;
-  validate(address);
+  page* pg;
+  bool missed = false;
+  bool* code;
+  validate_store(address, write_tlb);
+  if (dcache != NULL) dcache->access(address, true);
 
   uint32_t* dw = reinterpret_cast< uint32_t* > (block + (address % blockSize));
   *dw = (*dw & ~mask) | (data & mask);
-  vlog("Memory write word: address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << data << ", mask = " << mask);
+  if (*code) code_block_written(code);
+  if (track_stores) mark_stored(pg, address % blockSize, 4, mask);
+  log_write("Memory write word", address, data, mask);
 }
 
 void memory::write_half(uint64_t address, uint64_t data, uint64_t mask) {
 
   uint64_t index;
   uintptr_t block;
-  validate(address);
+  page* pg;
+  bool missed = false;
+  bool* code;
+  validate_store(address, write_tlb);
+  if (dcache != NULL) dcache->access(address, true);
 
   uint16_t *mem = reinterpret_cast<uint16_t *>(block + (address % blockSize));
   *mem = (*mem & ~mask) | (data & mask);
-  vlog("Memory write half: address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << data << ", mask = " << mask);
+  if (*code) code_block_written(code);
+  if (track_stores) mark_stored(pg, address % blockSize, 2, mask);
+  log_write("Memory write half", address, data, mask);
 }
 
 void memory::write_byte(uint64_t address, uint64_t data, uint64_t mask) {
 
   uint64_t index;
   uintptr_t block;
-  validate(address);
+  page* pg;
+  bool missed = false;
+  bool* code;
+  validate_store(address, write_tlb);
+  if (dcache != NULL) dcache->access(address, true);
 
-  uint16_t *mem = reinterpret_cast<uint16_t *>(block + (address % blockSize));
+  uint8_t *mem = reinterpret_cast<uint8_t *>(block + (address % blockSize));
   *mem = (*mem & ~mask) | (data & mask);
-  vlog("Memory write byte: address = " << setfill('0') << setw(16) << std::hex << address << ", data = " << data << ", mask = " << mask);
+  if (*code) code_block_written(code);
+  if (track_stores) mark_stored(pg, address % blockSize, 1, mask);
+  log_write("Memory write byte", address, data, mask);
+}
+
+// Copy length bytes to guest memory a page at a time
+void memory::write_block(uint64_t address, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    uint64_t offset = address % blockSize;
+    size_t chunk = blockSize - offset;
+    if (chunk > length)
+      chunk = length;
+    uint8_t* host;
+    bool* code;
+    if (address - ram_base < ram_size) {
+      host = ram + (address - ram_base);
+      code = &ram_code[(address - ram_base) / blockSize];
+    } else {
+      page* pg = find_writable_page(address/blockSize);
+      host = pg->data + offset;
+      code = &pg->code;
+    }
+    memcpy(host, data, chunk);
+    if (*code) code_block_written(code);
+    address += chunk;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+struct memory::snapshot {
+  vector<page*> pages;          // in page number order, each holding a reference
+  vector<uint64_t> ram_offsets; // RAM region pages the host had touched
+  vector<uint8_t> ram_data;     // and their contents, blockSize bytes each
+};
+
+// Offsets of the RAM region pages the host has backed with memory. The rest still read as zero
+static vector<uint64_t> ram_touched(uint8_t* ram, uint64_t ram_size) {
+  vector<uint64_t> offsets;
+  uint64_t host_page = sysconf(_SC_PAGESIZE);
+  vector<unsigned char> resident((ram_size + host_page - 1) / host_page);
+  if (mincore(ram, ram_size, resident.data()) != 0) {
+    // can't tell, so treat every page as touched
+    resident.assign(resident.size(), 1);
+  }
+  for (uint64_t offset = 0; offset < ram_size; offset += blockSize)
+    if (resident[offset / host_page] & 1)
+      offsets.push_back(offset);
+  return offsets;
+}
+
+memory::snapshot* memory::take_snapshot() {
+  snapshot* s = new snapshot;
+  vector<uintptr_t*> slots;
+  collect_pages(&root, slots);
+  s->pages.reserve(slots.size());
+  for (size_t i = 0; i < slots.size(); i++) {
+    page* pg = (page*)(*slots[i] & ~(uintptr_t)1);
+    page_ref(pg);
+    s->pages.push_back(pg);
+  }
+  // every page is shared now, so stores have to miss and copy
+  memset(write_tlb.entry, 0xff, sizeof(write_tlb.entry));
+
+  if (ram != NULL) {
+    s->ram_offsets = ram_touched(ram, ram_size);
+    s->ram_data.resize(s->ram_offsets.size() * blockSize);
+    for (size_t i = 0; i < s->ram_offsets.size(); i++)
+      memcpy(&s->ram_data[i * blockSize], ram + s->ram_offsets[i], blockSize);
+  }
+  return s;
+}
+
+void memory::restore_snapshot(const snapshot* s) {
+  vector<uintptr_t*> slots;
+  collect_pages(&root, slots);
+
+  // Both lists are in page number order. A page that is in both hasn't been stored to since.
+  // Decoded instructions only go stale if a page that goes had been decoded from
+  vector<page*> missing;
+  bool changed = false;
+  size_t i = 0, j = 0;
+  while (i < slots.size() || j < s->pages.size()) {
+    page* live = i < slots.size() ? (page*)(*slots[i] & ~(uintptr_t)1) : NULL;
+    page* saved = j < s->pages.size() ? s->pages[j] : NULL;
+    if (live == saved) {
+      i++;
+      j++;
+      continue;
+    }
+    if (saved == NULL || (live != NULL && live->index < saved->index)) {
+      // allocated since the snapshot
+      changed |= __atomic_load_n(&live->code, __ATOMIC_RELAXED);
+      *slots[i++] = 0;
+      release_page(live);
+    } else if (live == NULL || saved->index < live->index) {
+      // dropped by restoring an older snapshot. Inserting can move pages, so it waits
+      missing.push_back(saved);
+      j++;
+    } else {
+      // copied by a store since the snapshot
+      changed |= __atomic_load_n(&live->code, __ATOMIC_RELAXED);
+      *slots[i++] = (uintptr_t)saved | 1;
+      page_ref(saved);
+      release_page(live);
+      j++;
+    }
+  }
+  for (size_t k = 0; k < missing.size(); k++)
+    insert_page(missing[k]);
+
+  if (ram != NULL) {
+    changed = true;
+    // put back every saved page, and zero anything touched since
+    for (size_t k = 0; k < s->ram_offsets.size(); k++)
+      memcpy(ram + s->ram_offsets[k], &s->ram_data[k * blockSize], blockSize);
+    vector<uint64_t> touched = ram_touched(ram, ram_size);
+    size_t k = 0;
+    for (size_t t = 0; t < touched.size(); t++) {
+      while (k < s->ram_offsets.size() && s->ram_offsets[k] < touched[t]) k++;
+      if (k == s->ram_offsets.size() || s->ram_offsets[k] != touched[t])
+        memset(ram + touched[t], 0, blockSize);
+    }
+  }
+
+  tlb_flush();
+  if (changed) code_generation++;
+}
+
+void memory::free_snapshot(snapshot* s) {
+  for (size_t i = 0; i < s->pages.size(); i++)
+    release_page(s->pages[i]);
+  delete s;
+}
+
+void memory::merge_changes(memory& view) {
+  vector<uintptr_t*> slots;
+  view.collect_pages(&view.root, slots);
+
+  for (size_t i = 0; i < slots.size(); i++) {
+    const page* pg = (const page*)(*slots[i] & ~(uintptr_t)1);
+    if (pg->stored == NULL)
+      continue;
+
+    // store each run of stored bytes, skipping untouched doublewords a whole one at a time
+    uint64_t offset = 0;
+    while (offset < blockSize) {
+      if (offset % 8 == 0 && ((pg->stored[offset / 64] >> (offset % 64)) & 0xff) == 0) {
+        offset += 8;
+        continue;
+      }
+      if (!((pg->stored[offset / 64] >> (offset % 64)) & 1)) {
+        offset++;
+        continue;
+      }
+      uint64_t end = offset + 1;
+      while (end < blockSize && ((pg->stored[end / 64] >> (end % 64)) & 1)) end++;
+      write_block(pg->index * blockSize + offset, pg->data + offset, end - offset);
+      offset = end;
+    }
+  }
+}
+
+// Value of each ASCII hex digit, -1 for any other character
+static int8_t hex_digit[256];
+static bool hex_digit_ready = false;
+
+static void init_hex_digits() {
+  hex_digit_ready = true;
+  memset(hex_digit, -1, sizeof(hex_digit));
+  for (int i = 0; i < 10; i++)
+    hex_digit['0' + i] = i;
+  for (int i = 0; i < 6; i++) {
+    hex_digit['a' + i] = 10 + i;
+    hex_digit['A' + i] = 10 + i;
+  }
+}
+
+// Map a whole file read-only. Empty files map to NULL
+static bool map_file(const string& file_name, const uint8_t*& data, size_t& size) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    if (fd >= 0)
+      close(fd);
+    cout << "Failed to open file" << endl;
+    return false;
+  }
+  size = file_stat.st_size;
+  data = NULL;
+  if (size > 0) {
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      close(fd);
+      cout << "Failed to open file" << endl;
+      return false;
+    }
+    data = (const uint8_t*)mapped;
+  }
+  close(fd);
+  return true;
+}
+
+static bool is_elf(const uint8_t* data, size_t size) {
+  return size >= 4 && data[0] == 0x7f && data[1] == 'E' && data[2] == 'L' && data[3] == 'F';
 }
 
 // Load a hex image file and provide the start address for execution from the file in start_address.
 // Return true if the file was read without error, or false otherwise.
+// ELF files are recognised by their magic number and loaded with load_elf.
 bool memory::load_file(string file_name, uint64_t &start_address) {
-  ifstream input_file(file_name);
-  string input;
+  const uint8_t* data;
+  size_t size;
+  if (!map_file(file_name, data, size))
+    return false;
+  symbols.clear();
+  bool ok = is_elf(data, size) ? load_elf_image(data, size, start_address)
+                               : load_hex_image(data, size, start_address);
+  if (data != NULL)
+    munmap((void*)data, size);
+  return ok;
+}
+
+bool memory::load_elf(string file_name, uint64_t &start_address) {
+  const uint8_t* data;
+  size_t size;
+  if (!map_file(file_name, data, size))
+    return false;
+  symbols.clear();
+  bool ok = false;
+  if (is_elf(data, size))
+    ok = load_elf_image(data, size, start_address);
+  else
+    cout << "Not an ELF file" << endl;
+  if (data != NULL)
+    munmap((void*)data, size);
+  return ok;
+}
+
+// Function labels in a listing look like "0000000000000014 <random>:"
+bool memory::load_symbols(string file_name) {
+  ifstream in(file_name.c_str());
+  if (!in) {
+    cout << "Can't read symbols from " << file_name << endl;
+    return false;
+  }
+  symbols.clear();
+  string line;
+  while (getline(in, line)) {
+    char* end;
+    uint64_t address = strtoull(line.c_str(), &end, 16);
+    size_t open = end - line.c_str();
+    size_t close = line.rfind(">:");
+    if (open == 0 || line.compare(open, 2, " <") != 0 || close == string::npos || close < open + 2)
+      continue;
+    symbols.add(address, 0, true, line.substr(open + 2, close - open - 2));
+  }
+  if (symbols.empty()) {
+    cout << "No symbols in " << file_name << endl;
+    return false;
+  }
+  return true;
+}
+
+// Parse an Intel HEX image that's already in memory, copying each data record into place in one go
+bool memory::load_hex_image(const uint8_t* data, size_t size, uint64_t &start_address) {
+  if (!hex_digit_ready)
+    init_hex_digits();
+
+  const uint8_t* p = data;
+  const uint8_t* end = data + size;
   unsigned int line_count = 0;
   unsigned int byte_count = 0;
-  char record_start;
-  char byte_string[3];
-  char halfword_string[5];
-  unsigned int record_length;
-  unsigned int record_address;
-  unsigned int record_type;
-  unsigned int record_data;
-  unsigned int record_checksum;
-  bool end_of_file_record = false;
-  uint64_t load_address;
-  uint64_t load_data;
-  uint64_t load_mask;
+  uint8_t record[5 + 255];    // length, address (2), type, data, checksum
+  bool ok = true;
   uint64_t load_base_address = 0x0000000000000000ULL;
   start_address = 0x0000000000000000ULL;
-  if (input_file.is_open()) {
-    while (true) {
-      line_count++;
-      input_file >> record_start;
-      if (record_start != ':') {
-	cout << "Input line " << dec << line_count << " does not start with colon character" << endl;
-	return false;
-      }
-      input_file.get(byte_string, 3);
-      sscanf(byte_string, "%x", &record_length);
-      input_file.get(halfword_string, 5);
-      sscanf(halfword_string, "%x", &record_address);
-      input_file.get(byte_string, 3);
-      sscanf(byte_string, "%x", &record_type);
-      switch (record_type) {
-      case 0x00:  // Data record
-	for (unsigned int i = 0; i < record_length; i++) {
-	  input_file.get(byte_string, 3);
-	  sscanf(byte_string, "%x", &record_data);
-	  load_address = (load_base_address | (uint64_t)(record_address)) + i;
-	  load_data = (uint64_t)(record_data) << ((load_address % 8) * 8);
-	  load_mask = 0x00000000000000ffULL << ((load_address % 8) * 8);
-	  write_doubleword(load_address & 0xfffffffffffffff8ULL, load_data, load_mask);
-	  byte_count++;
-	}
-	break;
-      case 0x01:  // End of file
-	end_of_file_record = true;
-	break;
-      case 0x02:  // Extended segment address (set bits 19:4 of load base address)
-	load_base_address = 0x0000000000000000ULL;
-	for (unsigned int i = 0; i < record_length; i++) {
-	  input_file.get(byte_string, 3);
-	  sscanf(byte_string, "%x", &record_data);
-	  load_base_address = (load_base_address << 8) | (record_data << 4);
-	}
-	break;
-      case 0x03:  // Start segment address (ignored)
-	for (unsigned int i = 0; i < record_length; i++) {
-	  input_file.get(byte_string, 3);
-	  sscanf(byte_string, "%x", &record_data);
-	}
-	break;
-      case 0x04:  // Extended linear address (set upper halfword of load base address)
-	load_base_address = 0x0000000000000000ULL;
-	for (unsigned int i = 0; i < record_length; i++) {
-	  input_file.get(byte_string, 3);
-	  sscanf(byte_string, "%x", &record_data);
-	  load_base_address = (load_base_address << 8) | (record_data << 16);
-	}
-	break;
-      case 0x05:  // Start linear address (set execution start address)
-	start_address = 0x0000000000000000ULL;
-	for (unsigned int i = 0; i < record_length; i++) {
-	  input_file.get(byte_string, 3);
-	  sscanf(byte_string, "%x", &record_data);
-	  start_address = (start_address << 8) | record_data;
-	}
-	break;
-      }
-      input_file.get(byte_string, 3);
-      sscanf(byte_string, "%x", &record_checksum);
-      input_file.ignore();
-      if (end_of_file_record)
-	break;
+
+  while (true) {
+    while (p < end && isspace(*p))
+      p++;
+    if (p == end)
+      break;  // no end of file record, take what was there
+    line_count++;
+    if (*p++ != ':') {
+      cout << "Input line " << dec << line_count << " does not start with colon character" << endl;
+      ok = false;
+      break;
     }
-    input_file.close();
-    cout << dec << byte_count << " bytes loaded, start address = "
-	 << setw(16) << setfill('0') << hex << start_address << endl;
-    return true;
+
+    // Decode the header, then the data and checksum once the length is known
+    size_t record_bytes = 4;
+    size_t i;
+    uint8_t checksum = 0;
+    for (i = 0; i < record_bytes; i++) {
+      int high = (p + 1 < end) ? hex_digit[p[0]] : -1;
+      int low = (p + 1 < end) ? hex_digit[p[1]] : -1;
+      if ((high | low) < 0)
+        break;
+      record[i] = (high << 4) | low;
+      checksum += record[i];
+      p += 2;
+      if (i == 3)
+        record_bytes = 5 + record[0];
+    }
+    if (i < record_bytes) {
+      cout << "Input line " << dec << line_count << " is not a valid hex record" << endl;
+      ok = false;
+      break;
+    }
+    if (checksum != 0) {
+      cout << "Input line " << dec << line_count << " has a bad checksum" << endl;
+      ok = false;
+      break;
+    }
+
+    unsigned int record_length = record[0];
+    unsigned int record_address = (record[1] << 8) | record[2];
+    unsigned int record_type = record[3];
+    const uint8_t* record_data = record + 4;
+
+    if (record_type == 0x00) {  // Data record
+      write_block(load_base_address | (uint64_t)(record_address), record_data, record_length);
+      byte_count += record_length;
+    }
+    else if (record_type == 0x01) {  // End of file
+      break;
+    }
+    else if (record_type == 0x02) {  // Extended segment address (set bits 19:4 of load base address)
+      load_base_address = 0x0000000000000000ULL;
+      for (i = 0; i < record_length; i++)
+        load_base_address = (load_base_address << 8) | ((uint64_t)record_data[i] << 4);
+    }
+    else if (record_type == 0x04) {  // Extended linear address (set upper halfword of load base address)
+      load_base_address = 0x0000000000000000ULL;
+      for (i = 0; i < record_length; i++)
+        load_base_address = (load_base_address << 8) | ((uint64_t)record_data[i] << 16);
+    }
+    else if (record_type == 0x05) {  // Start linear address (set execution start address)
+      start_address = 0x0000000000000000ULL;
+      for (i = 0; i < record_length; i++)
+        start_address = (start_address << 8) | record_data[i];
+    }
+    // Start segment address (0x03) is ignored
   }
-  else {
-    cout << "Failed to open file" << endl;
+
+  if (!ok)
     return false;
+  cout << dec << byte_count << " bytes loaded, start address = "
+       << setw(16) << setfill('0') << hex << start_address << endl;
+  return true;
+}
+
+void memory::free_node(radix_node* node) {
+  for (int i = 0; i < radixFanout; i++) {
+    uintptr_t entry = node->slot[i];
+    if (entry & 1)
+      release_page( reinterpret_cast<page*>(entry & ~(uintptr_t)1) );
+    else if (entry)
+      free_node( reinterpret_cast<radix_node*>(entry) );
   }
+  if (node != &root)
+    free(node);
 }
 
 memory::~memory() {
-  // free every block, which is every key/value in the map
-  for (auto it = mem_m.begin(); it != mem_m.end(); ++it) {
-    // free an individual block
-    free( reinterpret_cast<void*>(it->second) );
+  // free every page and table node below the root
+  free_node(&root);
+  if (ram != NULL) {
+    munmap(ram, ram_size);
+    free(ram_code);
   }
-}
\ No newline at end of file
+}
@@ -10,26 +10,103 @@
 **************************************************************** */
 
 #include <vector>
-#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+#include "symbols.h"
+
+class cache;
 
 using namespace std;
 
-#define blockSize 2048
+// Guest page size. Pages are the unit of allocation and of the code flags
+#define blockSize 4096
 
-class memory {
+// Page number bits resolved by each level of the page table, and the number of levels
+// needed to cover the 52 bit page number
+#define radixBits 6
+#define radixFanout (1 << radixBits)
+#define radixLevels ((64 - 12 + radixBits - 1) / radixBits)
 
- private:
+// Entries in each direct-mapped TLB
+#define TLB_ENTRIES 256
 
+class memory {
 
-  // hints:
-  //   // Store implemented as an unordered_map of vectors, each containing 4Kbytes (512 doublewords) of data.
-  //   unordered_map< uint64_t, vector<uint64_t> > store;  // Initially empty
+ private:
 
-  unordered_map<uint64_t, uintptr_t> mem_m;
+  // One guest page. A page sits in the shallowest table slot no other page shares,
+  // so it keeps its own page number to tell it apart from pages further down.
+  struct page {
+    uint64_t index;
+    bool code;     // holds decoded instructions, a store here bumps code_generation
+    uint32_t refs; // page tables and snapshots holding it. Shared pages are copied before a store
+    uint64_t* stored; // a bit for each byte stored to, for a memory tracking stores. NULL until the first
+    uint8_t data[blockSize];
+  };
+
+  // Table node. A slot is empty, a child node, or a page tagged with bit 0 set.
+  struct radix_node {
+    uintptr_t slot[radixFanout];
+  };
+
+  radix_node root;
+  uint64_t node_count;
+  uint64_t page_count;
   bool verbose;
 
-  uint64_t cached_block_index;
-  uintptr_t cached_block_addr;
+  // Software TLBs in front of the page table, one each for instruction fetch, loads and stores
+  // so code and data pages don't evict each other. A tag of all ones never matches a page number.
+  struct tlb {
+    struct {
+      uint64_t index;
+      page* pg;
+    } entry[TLB_ENTRIES];
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  tlb fetch_tlb;
+  tlb read_tlb;
+  tlb write_tlb;
+
+  uint64_t code_generation;
+
+  // Symbols from the last ELF file loaded
+  symbol_table symbols;
+
+  // Optional contiguous RAM region, checked before the page table. ram_size is 0 when there isn't one
+  uint8_t* ram;
+  bool* ram_code;      // code flag for each page of the region
+  uint64_t ram_base;
+  uint64_t ram_size;
+  uint64_t ram_fast_size;   // ram_size, or 0 while accesses are logged
+
+  bool log_accesses;        // verbose in a LOGGING build
+
+  cache* dcache;            // D-cache model every read_* and write_* is looked up in, NULL for none
+
+  bool track_stores;        // note which bytes of each page write_* stores to, for merge_changes()
+
+  // Page holding page number index, allocated (zeroed) if it isn't there yet
+  page* find_page(uint64_t index);
+  // Same, but copies the page first if a snapshot shares it, so it can be stored to
+  page* find_writable_page(uint64_t index);
+  // Slot in the page table holding page number index, which must already have a page
+  uintptr_t* find_slot(uint64_t index);
+  // Put pg in the page table at its page number, which must not have a page yet
+  void insert_page(page* pg);
+  void release_page(page* pg);
+  // Every page table slot holding a page, in page number order
+  void collect_pages(radix_node* node, vector<uintptr_t*>& slots);
+  void free_node(radix_node* node);
+  void code_block_written(bool* code);
+  void mark_stored(page* pg, uint64_t offset, unsigned int bytes, uint64_t mask);
+  void tlb_reset(tlb& t);
+  void log_access(const char* what, uint64_t address, uint64_t data);
+  void log_access(const char* what, uint64_t address, uint64_t data, uint64_t mask);
+  bool load_hex_image(const uint8_t* data, size_t size, uint64_t &start_address);
+  bool load_elf_image(const uint8_t* data, size_t size, uint64_t &start_address);
   
  public:
 
@@ -38,11 +115,18 @@ class memory {
   // Destructor (frees memory)
   ~memory();
      
+  // Map size bytes of guest memory at base as one contiguous host region. Both must be page aligned,
+  // and it has to happen before anything is loaded. Returns false if the region can't be mapped
+  bool map_ram(uint64_t base, uint64_t size);
+     
   // Read a doubleword of data from a doubleword-aligned address.
   // If the address is not a multiple of 8, it is rounded down to a multiple of 8.
   uint64_t read_doubleword (uint64_t address);
   uint32_t read_word (uint64_t address);
 
+  // Read an instruction word. Same as read_word but looked up in the fetch TLB
+  uint32_t fetch_word (uint64_t address);
+
 
   // Write a doubleword of data to a doubleword-aligned address.
   // If the address is not a multiple of 8, it is rounded down to a multiple of 8.
@@ -52,11 +136,88 @@ class memory {
   void write_half(uint64_t address, uint64_t data, uint64_t mask);
   void write_byte(uint64_t address, uint64_t data, uint64_t mask);
 
-
+  // Look up every read_* and write_* from now on in a D-cache model, which stays the caller's
+  inline void set_dcache(cache* dcache) {
+    this->dcache = dcache;
+  }
+  inline cache* get_dcache() {
+    return dcache;
+  }
+
+
+  // Host memory held by the page table: pages, and the table nodes above them
+  inline uint64_t get_page_count() {
+    return page_count;
+  }
+  inline uint64_t get_memory_use() {
+    return page_count * sizeof(page) + (node_count + 1) * sizeof(radix_node);
+  }
+
+  // TLB hit and miss counts
+  enum tlb_kind {tlb_fetch, tlb_read, tlb_write};
+  inline uint64_t get_tlb_hits(tlb_kind kind) {
+    return kind == tlb_fetch ? fetch_tlb.hits : kind == tlb_read ? read_tlb.hits : write_tlb.hits;
+  }
+  inline uint64_t get_tlb_misses(tlb_kind kind) {
+    return kind == tlb_fetch ? fetch_tlb.misses : kind == tlb_read ? read_tlb.misses : write_tlb.misses;
+  }
+
+  // Drop every TLB entry. Needed whenever a page is freed or replaced
+  void tlb_flush();
+
+  // Guest memory at the time take_snapshot() was called
+  struct snapshot;
+
+  // Capture guest memory. Pages are shared with the page table and only copied when one is next
+  // stored to, so this just walks the table. The RAM region has no pages to share, so the parts
+  // of it the host has touched are copied. Snapshots must be freed before the memory is
+  snapshot* take_snapshot();
+
+  // Put guest memory back the way it was when s was taken. Pages that haven't been stored to since
+  // are left alone, and the rest are swapped back rather than copied. s can come from another memory,
+  // even one in use on another thread: the pages are shared between them until written
+  void restore_snapshot(const snapshot* s);
+
+  void free_snapshot(snapshot* s);
+
+  // Note which bytes write_* stores to, so merge_changes() can publish them. Pages only start
+  // noting stores once they are this memory's own, so restoring a snapshot clears what was noted
+  inline void set_store_tracking(bool enabled) {
+    track_stores = enabled;
+  }
+
+  // Store every byte that view, which tracks its stores, has stored to since it was restored from a
+  // snapshot of this memory, even one written back unchanged. This is how a hart's stores are
+  // published at the end of a quantum. The RAM region isn't covered
+  void merge_changes(memory& view);
+
+  // Copy a run of bytes into memory, the bulk equivalent of write_byte
+  void write_block(uint64_t address, const uint8_t* data, size_t length);
+
+  // Flag the page containing address as holding decoded instructions
+  void mark_code(uint64_t address);
+
+  // Incremented every time a store lands in a page flagged by mark_code()
+  inline uint64_t get_code_generation() {
+    return code_generation;
+  }
 
   // Load a hex image file and provide the start address for execution from the file in start_address.
   // Return true if the file was read without error, or false otherwise.
+  // ELF files are recognised and loaded as by load_elf.
   bool load_file(string file_name, uint64_t &start_address);
+
+  // Load the PT_LOAD segments of an ELF64 RISC-V executable and take the start address from e_entry.
+  // The symbol table is kept, see get_symbols().
+  bool load_elf(string file_name, uint64_t &start_address);
+
+  // Replace the symbol table with the functions labelled in an objdump -d listing, for programs loaded
+  // from hex files. Returns false, with a message, if the file can't be read or has no labels
+  bool load_symbols(string file_name);
+
+  inline const symbol_table& get_symbols() {
+    return symbols;
+  }
 };
 
 #endif
@@ -0,0 +1,69 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Pipeline timing configuration
+
+**************************************************************** */
+
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+
+#include "pipeline.h"
+
+using namespace std;
+
+const char* const rv64::stall_names[rv64::num_stalls] = {
+#define X(name, cycles) #name,
+  RV64_STALLS(X)
+#undef X
+};
+
+pipeline_config::pipeline_config() {
+#define X(name, cycles) latency[rv64::name##_stall] = cycles;
+  RV64_STALLS(X)
+#undef X
+}
+
+bool pipeline_config::load(const string& path) {
+  ifstream in(path.c_str());
+  if (!in) {
+    cout << "Can't open pipeline file " << path << endl;
+    return false;
+  }
+
+  string line;
+  unsigned int line_number = 0;
+  while (getline(in, line)) {
+    line_number++;
+    size_t comment = line.find('#');
+    if (comment != string::npos)
+      line.erase(comment);
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == string::npos)
+      continue;
+
+    size_t equals = line.find('=');
+    size_t name_end = line.find_first_of(" \t=", first);
+    string name = line.substr(first, name_end - first);
+    int reason = -1;
+    for (int s = 0; s < rv64::num_stalls; s++)
+      if (name == rv64::stall_names[s]) reason = s;
+    if (reason < 0) {
+      cout << path << ":" << dec << line_number << ": Unknown stall " << name << endl;
+      return false;
+    }
+
+    char* end = NULL;
+    unsigned long cycles = 0;
+    if (equals != string::npos)
+      cycles = strtoul(line.c_str() + equals + 1, &end, 10);
+    if (end == NULL || end == line.c_str() + equals + 1 || line.find_first_not_of(" \t\r", end - line.c_str()) != string::npos) {
+      cout << path << ":" << dec << line_number << ": Bad cycles for " << name << endl;
+      return false;
+    }
+    latency[reason] = cycles;
+  }
+  return true;
+}
@@ -0,0 +1,60 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Timing model for an in-order 5-stage pipeline
+
+**************************************************************** */
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/**
+ * Reasons the pipeline stalls or flushes, with the cycles each costs on top of the one cycle
+ * every instruction takes. Each X(name, cycles) gets an rv64::name_stall enum value and an entry
+ * in stall_names, and can be changed in a --pipeline file. The defaults match the cycle counts
+ * in the tests' expected -c logs
+ */
+#define RV64_STALLS(X) \
+  X(load, 2)        /* every load, while the memory stage waits */ \
+  X(store, 1)       /* every store */ \
+  X(load_use, 0)    /* the next instruction reads what a load wrote */ \
+  X(branch, 1)      /* a conditional branch is taken */ \
+  X(jump, 1)        /* jal and jalr */ \
+  X(trap, 2)        /* flush on an exception or ebreak */ \
+  X(interrupt, 2)   /* flush on taking an interrupt */ \
+  X(mret, 0)        /* flush on returning from a trap */ \
+  X(mispredict, 1)  /* with --bpred-cycles, in place of branch and jump */ \
+  X(icache_hit, 0)  /* every fetch with --icache, on top of the cycle the instruction takes */ \
+  X(icache_miss, 20) \
+  X(dcache_hit, 0)  /* every load and store with --dcache, on top of their stalls */ \
+  X(dcache_miss, 20)
+
+namespace rv64 {
+  enum stall {
+#define X(name, cycles) name##_stall,
+    RV64_STALLS(X)
+#undef X
+    num_stalls
+  };
+
+  extern const char* const stall_names[num_stalls];
+}
+
+// Cycles each stall costs
+struct pipeline_config {
+  unsigned int latency[rv64::num_stalls];
+
+  pipeline_config();
+
+  // Read "name = cycles" lines, # starts a comment. Reasons not in the file keep their defaults.
+  // Returns false, with a message, if the file can't be read or has a bad line
+  bool load(const string& path);
+};
+
+#endif
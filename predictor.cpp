@@ -0,0 +1,233 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for branch_predictor
+
+**************************************************************** */
+
+#include <iostream>
+#include <stdlib.h>
+
+#include "predictor.h"
+
+using namespace std;
+
+const char* const branch_predictor::kind_names[branch_predictor::num_kinds] = {
+#define X(name) #name,
+  PREDICTOR_KINDS(X)
+#undef X
+};
+
+predictor_config::predictor_config() {
+  enabled = false;
+  kind = branch_predictor::gshare;
+  table_bits = 12;
+  btb_entries = 512;
+  ras_entries = 16;
+}
+
+bool predictor_config::parse(const string& spec) {
+  size_t comma = spec.find(',');
+  string name = spec.substr(0, comma);
+  int found = -1;
+  for (int k = 0; k < branch_predictor::num_kinds; k++)
+    if (name == branch_predictor::kind_names[k]) found = k;
+
+  table_bits = 12;
+  btb_entries = 512;
+  ras_entries = 16;
+  const char* rest = comma == string::npos ? "" : spec.c_str() + comma;
+  char* end = const_cast<char*>(rest);
+  if (*end == ',') table_bits = strtoul(end + 1, &end, 0);
+  if (*end == ',') btb_entries = strtoul(end + 1, &end, 0);
+  if (*end == ',') ras_entries = strtoul(end + 1, &end, 0);
+
+  enabled = found >= 0 && *end == '\0' && table_bits >= 4 && table_bits <= 24 &&
+            btb_entries != 0 && (btb_entries & (btb_entries - 1)) == 0;
+  if (!enabled) {
+    cout << "Bad branch predictor: " << spec << ", expected bimodal|gshare|tage[,table_bits[,btb_entries[,ras_entries]]]" << endl;
+    return false;
+  }
+  kind = found;
+  return true;
+}
+
+branch_predictor::branch_predictor(const predictor_config& config) {
+  this->config = config;
+  counter_mask = (1ULL << config.table_bits) - 1;
+  // weakly not taken
+  counters.assign(((1ULL << config.table_bits) + 31) / 32, 0x5555555555555555ULL);
+  history = 0;
+
+  // the tagged tables share out as many entries as the base table has
+  tagged_bits = config.table_bits - 2;
+  tagged_mask = (1ULL << tagged_bits) - 1;
+  if (config.kind == tage) {
+    for (int t = 0; t < TAGE_TABLES; t++)
+      tagged[t].assign(1ULL << tagged_bits, 0);
+  }
+  tage_ticks = 0;
+
+  btb.assign(config.btb_entries, btb_entry());
+  for (size_t i = 0; i < btb.size(); i++) {
+    btb[i].pc = ~0ULL;
+    btb[i].target = 0;
+  }
+  ras.assign(config.ras_entries, 0);
+  ras_top = 0;
+  ras_depth = 0;
+
+  branches = 0;
+  branch_misses = 0;
+  jumps = 0;
+  jump_misses = 0;
+}
+
+void branch_predictor::train(uint64_t index, bool taken) {
+  unsigned int c = counter(index);
+  if (taken && c < 3) c++;
+  else if (!taken && c > 0) c--;
+  unsigned int shift = (index & 31) * 2;
+  counters[index >> 5] = (counters[index >> 5] & ~(3ULL << shift)) | ((uint64_t)c << shift);
+}
+
+// The newest length bits of history, xored down to bits bits
+uint64_t branch_predictor::fold_history(unsigned int length, unsigned int bits) {
+  uint64_t h = length < 64 ? history & ((1ULL << length) - 1) : history;
+  uint64_t folded = 0;
+  while (h != 0) {
+    folded ^= h & ((1ULL << bits) - 1);
+    h >>= bits;
+  }
+  return folded;
+}
+
+// A cut-down TAGE: the longest history table with a matching tag predicts, the base table if none
+// does. Returns the prediction, having trained on taken
+bool branch_predictor::tage_predict(uint64_t pc, bool taken) {
+  static const unsigned int lengths[TAGE_TABLES] = TAGE_HISTORY_LENGTHS;
+  uint64_t index[TAGE_TABLES];
+  uint16_t tag[TAGE_TABLES];
+  int provider = -1;
+  int alternate = -1;
+
+  for (int t = TAGE_TABLES - 1; t >= 0; t--) {
+    index[t] = ((pc >> 2) ^ (pc >> (2 + tagged_bits)) ^ fold_history(lengths[t], tagged_bits)) & tagged_mask;
+    tag[t] = ((pc >> 2) ^ fold_history(lengths[t], 11) ^ (fold_history(lengths[t], 10) << 1)) & 0x7FF;
+    if (tag[t] == 0) tag[t] = 1;  // so an empty entry never matches
+    if ((tagged[t][index[t]] >> 5) == tag[t]) {
+      if (provider < 0) provider = t;
+      else if (alternate < 0) alternate = t;
+    }
+  }
+
+  uint64_t base = (pc >> 2) & counter_mask;
+  bool base_prediction = counter(base) >= 2;
+  bool alternate_prediction = alternate >= 0 ? ((tagged[alternate][index[alternate]] >> 2) & 7) >= 4 : base_prediction;
+  bool prediction = provider >= 0 ? ((tagged[provider][index[provider]] >> 2) & 7) >= 4 : base_prediction;
+
+  if (provider >= 0) {
+    uint16_t& e = tagged[provider][index[provider]];
+    unsigned int c = (e >> 2) & 7;
+    unsigned int useful = e & 3;
+    if (taken && c < 7) c++;
+    else if (!taken && c > 0) c--;
+    // an entry is useful when it gets right what the next one down would have got wrong
+    if (prediction != alternate_prediction) {
+      if (prediction == taken && useful < 3) useful++;
+      else if (prediction != taken && useful > 0) useful--;
+    }
+    e = (e & 0xFFE0) | (c << 2) | useful;
+  }
+  else {
+    train(base, taken);
+  }
+
+  // on a miss, give the branch an entry with more history, or make room for one next time
+  if (prediction != taken && provider < TAGE_TABLES - 1) {
+    bool allocated = false;
+    for (int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+      uint16_t& e = tagged[t][index[t]];
+      if ((e & 3) == 0) {
+        e = (tag[t] << 5) | ((taken ? 4 : 3) << 2);
+        allocated = true;
+      }
+    }
+    // every useful count is above 0 here, and it's in the low bits
+    for (int t = provider + 1; t < TAGE_TABLES && !allocated; t++)
+      tagged[t][index[t]]--;
+  }
+
+  if (++tage_ticks % TAGE_RESET_PERIOD == 0) {
+    for (int t = 0; t < TAGE_TABLES; t++)
+      for (size_t i = 0; i < tagged[t].size(); i++)
+        tagged[t][i] &= ~3;
+  }
+  return prediction;
+}
+
+bool branch_predictor::btb_hit(uint64_t pc, uint64_t target) {
+  const btb_entry& e = btb[(pc >> 2) & (btb.size() - 1)];
+  return e.pc == pc && e.target == target;
+}
+
+void branch_predictor::btb_update(uint64_t pc, uint64_t target) {
+  btb_entry& e = btb[(pc >> 2) & (btb.size() - 1)];
+  e.pc = pc;
+  e.target = target;
+}
+
+bool branch_predictor::branch(uint64_t pc, bool taken, uint64_t target) {
+  bool prediction;
+  uint64_t index;
+  switch (config.kind) {
+    case bimodal:
+      index = (pc >> 2) & counter_mask;
+      prediction = counter(index) >= 2;
+      train(index, taken);
+      break;
+
+    case gshare:
+      index = ((pc >> 2) ^ history) & counter_mask;
+      prediction = counter(index) >= 2;
+      train(index, taken);
+      break;
+
+    default:
+      prediction = tage_predict(pc, taken);
+      break;
+  }
+  history = (history << 1) | taken;
+
+  bool miss = prediction != taken || (taken && !btb_hit(pc, target));
+  if (taken) btb_update(pc, target);
+  branches++;
+  if (miss) branch_misses++;
+  return miss;
+}
+
+bool branch_predictor::jump(uint64_t pc, bool indirect, uint8_t rd, uint8_t rs1, uint64_t target) {
+  bool is_return = indirect && rd == 0 && (rs1 == 1 || rs1 == 5);
+  bool miss;
+
+  if (is_return && ras_depth > 0) {
+    miss = ras[ras_top] != target;
+    ras_top = (ras_top + ras.size() - 1) % ras.size();
+    ras_depth--;
+  }
+  else {
+    miss = !btb_hit(pc, target);
+    btb_update(pc, target);
+  }
+
+  if ((rd == 1 || rd == 5) && !ras.empty()) {
+    ras_top = (ras_top + 1) % ras.size();
+    ras[ras_top] = pc + 4;
+    if (ras_depth < ras.size()) ras_depth++;
+  }
+
+  jumps++;
+  if (miss) jump_misses++;
+  return miss;
+}
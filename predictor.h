@@ -0,0 +1,123 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Branch predictor models
+
+**************************************************************** */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Direction predictors. Each X(name) gets a branch_predictor::name enum value and an entry in
+ * kind_names, which is also how --bpred spells it
+ */
+#define PREDICTOR_KINDS(X) \
+  X(bimodal) X(gshare) X(tage)
+
+// Tagged tables in the TAGE predictor, and the global history each one hashes in
+#define TAGE_TABLES 4
+#define TAGE_HISTORY_LENGTHS { 5, 11, 22, 44 }
+
+// Branches between clearing the TAGE useful bits, so old entries can be replaced
+#define TAGE_RESET_PERIOD (1 << 18)
+
+struct predictor_config {
+  bool enabled;
+  uint8_t kind;               // branch_predictor::kind
+  unsigned int table_bits;    // log2 of the counters in the direction table, TAGE's base table included
+  unsigned int btb_entries;
+  unsigned int ras_entries;
+
+  predictor_config();
+
+  // Read "kind[,table_bits[,btb_entries[,ras_entries]]]". BTB entries must be a power of two.
+  // Returns false, with a message, if the spec is bad
+  bool parse(const string& spec);
+};
+
+// Branches and mispredictions at one pc
+struct branch_stats {
+  uint64_t count;
+  uint64_t misses;
+};
+
+// Predicts the direction of conditional branches with one of the kinds above, and the target of
+// anything taken with a direct-mapped BTB, or the return address stack for returns. Counters are
+// 2 bits, 32 to a word, and a TAGE entry packs its tag, counter and useful bits into 16 bits
+class branch_predictor {
+
+ public:
+
+  enum kind {
+#define X(name) name,
+    PREDICTOR_KINDS(X)
+#undef X
+    num_kinds
+  };
+
+  static const char* const kind_names[num_kinds];
+
+ private:
+
+  struct btb_entry {
+    uint64_t pc;
+    uint64_t target;
+  };
+
+  predictor_config config;
+  vector<uint64_t> counters;      // 2 bit counters, taken from 2 up
+  uint64_t counter_mask;
+  uint64_t history;               // conditional branch outcomes, newest in bit 0
+
+  // TAGE: tag in bits 5-15, counter in bits 2-4 (taken from 4 up), useful in bits 0-1
+  vector<uint16_t> tagged[TAGE_TABLES];
+  uint64_t tagged_mask;
+  unsigned int tagged_bits;
+  uint64_t tage_ticks;
+
+  vector<btb_entry> btb;
+  vector<uint64_t> ras;           // circular, so a deep call chain overwrites the oldest returns
+  unsigned int ras_top;
+  unsigned int ras_depth;
+
+  inline unsigned int counter(uint64_t index) {
+    return (counters[index >> 5] >> ((index & 31) * 2)) & 3;
+  }
+  void train(uint64_t index, bool taken);
+
+  uint64_t fold_history(unsigned int length, unsigned int bits);
+  bool tage_predict(uint64_t pc, bool taken);
+  bool btb_hit(uint64_t pc, uint64_t target);
+  void btb_update(uint64_t pc, uint64_t target);
+
+ public:
+
+  uint64_t branches;
+  uint64_t branch_misses;
+  uint64_t jumps;
+  uint64_t jump_misses;
+
+  branch_predictor(const predictor_config& config);
+
+  inline const predictor_config& get_config() {
+    return config;
+  }
+
+  // Predict a conditional branch at pc, then train on what it did. Returns true if it was mispredicted:
+  // the wrong direction, or taken to somewhere the BTB didn't have
+  bool branch(uint64_t pc, bool taken, uint64_t target);
+
+  // Predict the target of jal (indirect false) or jalr at pc, then train on it. rd x1 or x5 makes it
+  // a call and jalr x0 through x1 or x5 a return. Returns true if it was mispredicted
+  bool jump(uint64_t pc, bool indirect, uint8_t rd, uint8_t rs1, uint64_t target);
+};
+
+#endif
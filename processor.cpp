@@ -18,6 +18,7 @@
 #include "Definitions.h"
 #include "LogControl.h"
 #include "Bits.h"
+#include "jit.h"
 
 using namespace std;
 using rv64::csr;
@@ -28,28 +29,6 @@ using rv64::csr;
   }
 //
 
-inline bool valid_csr(unsigned int csr_num) {
-  switch (csr_num) {
-    case csr::mvendorid:
-    case csr::marchid:
-    case csr::mimpid:
-    case csr::mhartid:
-    case csr::mstatus:
-    case csr::misa:
-    case csr::mie:
-    case csr::mtvec:
-    case csr::mscratch:
-    case csr::mepc:
-    case csr::mcause:
-    case csr::mtval:
-    case csr::mip:
-      return true;
-
-    default:
-      return false;
-  }
-}
-
 // Consructor
 processor::processor (memory* main_memory, bool verbose, bool stage2) {
   this->verbose = verbose;
@@ -59,27 +38,95 @@ processor::processor (memory* main_memory, bool verbose, bool stage2) {
   
   // initial states
   this->pc = 0;
-  this->breakpoint = NO_BREAKPOINT;
+  this->resume_pc = NO_BREAKPOINT;
   this->pc_changed = false;
   this->instruction_count = 0;
+  this->squashed = 0;
+  this->dropped = 0;
+  this->dropped_loads = 0;
+  memset(stall_events, 0, sizeof(stall_events));
+  this->threaded = false;
+  this->quiet = false;
+  this->at_breakpoint = false;
+  this->alive = true;
+  this->jit_engine = NULL;
+  this->icache = NULL;
+  this->predictor = NULL;
+  this->predictor_cycles = false;
+  this->profile_mix = false;
+  this->pc_profiler = NULL;
+  this->next_sample = 0;
+  this->graph = NULL;
+  this->tracer = NULL;
+  for (int k = 0; k < rv64::num_inst_kinds; k++) inst_mix[k] = 0;
+  this->dcache = NULL;
+  this->block_cache_generation = main_memory->get_code_generation();
   memset(reg, 0, sizeof(int64_t)*32);
   this->prv = 3;
   
   // initialise the CSRs
-  this->csr[0xf11] = 0x00;               // mvendorid
-  this->csr[0xf12] = 0x00;               // marchid
-  this->csr[0xf13] = 0x2023020000000000; // mimpid
-  this->csr[0xf14] = 0x00;               // mhartid
-  this->csr[0x300] = 0x0000000200000000; // mstatus
-  this->csr[0x301] = 0x8000000000100100; // misa
-  this->csr[0x304] = 0x00;               // mie
-  this->csr[0x305] = 0x00;               // mtvec
-  this->csr[0x340] = 0x00;               // mscratch
-  this->csr[0x341] = 0x00;               // mepc
-  this->csr[0x342] = 0x00;               // mcause
-  this->csr[0x343] = 0x00;               // mtval
-  this->csr[0x344] = 0x00;               // mip
+  csr.reset();
+  update_interrupts();
+}
+
+processor::~processor() {
+  delete jit_engine;
+  set_caches(cache_config(), cache_config());
+  delete predictor;
+  delete pc_profiler;
+  delete graph;
+  delete tracer;
+}
+
+void processor::set_predictor(const predictor_config& config, bool cycles) {
+  delete predictor;
+  predictor = config.enabled ? new branch_predictor(config) : NULL;
+  predictor_cycles = cycles && predictor != NULL;
+  if (predictor != NULL) set_jit(false);
+}
+
+void processor::set_profile_mix(bool enabled) {
+  fold_inst_mix();
+  profile_mix = enabled;
+  if (profile_mix) set_jit(false);
+}
+
+void processor::set_profiler(uint64_t interval) {
+  delete pc_profiler;
+  pc_profiler = interval != 0 ? new profiler(interval) : NULL;
+  next_sample = instruction_count + interval;
+  if (pc_profiler != NULL) set_jit(false);
+}
 
+void processor::set_call_graph(bool enabled) {
+  delete graph;
+  graph = enabled ? new call_graph(instruction_count, get_cycle_count()) : NULL;
+  if (graph != NULL) set_jit(false);
+}
+
+bool processor::set_trace(const string& path) {
+  bool ok = tracer == NULL || tracer->close();
+  delete tracer;
+  tracer = NULL;
+  if (path.empty()) return ok;
+
+  tracer = new trace_writer();
+  if (!tracer->open(path)) {
+    delete tracer;
+    tracer = NULL;
+    return false;
+  }
+  set_jit(false);
+  return ok;
+}
+
+void processor::set_caches(const cache_config& icache_config, const cache_config& dcache_config) {
+  delete icache;
+  delete dcache;
+  icache = icache_config.size != 0 ? new cache(icache_config) : NULL;
+  dcache = dcache_config.size != 0 ? new cache(dcache_config) : NULL;
+  mem->set_dcache(dcache);
+  if (icache != NULL) set_jit(false);
 }
 
 // Display PC value
@@ -93,74 +140,257 @@ void processor::show_reg(unsigned int reg_num) {
 }
 
 // Execute 'num' instructions
-void processor::execute(unsigned int num, bool breakpoint_check) {
+void processor::execute(unsigned int num, bool breakpoint_check, bool resume) {
+#ifdef LOGGING_ENABLED
+  bool log_steps = verbose;
+#else
+  bool log_steps = false;
+#endif
+  resume_pc = resume ? pc : NO_BREAKPOINT;
+  at_breakpoint = false;
+  if (threaded && !log_steps && tracer == NULL) {
+    execute_threaded(num, breakpoint_check);
+    return;
+  }
+
   this->alive = true;
 
+  (this->*execute_variants[stage2 * 8 + (tracer != NULL) * 4 + log_steps * 2 + breakpoint_check])(num);
+  pc_changed = false;
+
+  // this only runs when the program has finished executing, which leaves a breakpoint at 0
+  if (!alive && !quiet) {
+    cout << "Breakpoint reached at "; show_pc();
+    set_breakpoint(0);
+  }
+  vlog("Finished execution block at pc: " << std::hex << pc << std::endl);
+}
+
+// Indexed by stage2 * 8 + trace * 4 + verbose * 2 + breakpoint check
+const processor::execute_variant processor::execute_variants[16] = {
+  &processor::execute_loop<false, false, false, false>,
+  &processor::execute_loop<false, false, false, true>,
+  &processor::execute_loop<false, false, true, false>,
+  &processor::execute_loop<false, false, true, true>,
+  &processor::execute_loop<false, true, false, false>,
+  &processor::execute_loop<false, true, false, true>,
+  &processor::execute_loop<false, true, true, false>,
+  &processor::execute_loop<false, true, true, true>,
+  &processor::execute_loop<true, false, false, false>,
+  &processor::execute_loop<true, false, false, true>,
+  &processor::execute_loop<true, false, true, false>,
+  &processor::execute_loop<true, false, true, true>,
+  &processor::execute_loop<true, true, false, false>,
+  &processor::execute_loop<true, true, false, true>,
+  &processor::execute_loop<true, true, true, false>,
+  &processor::execute_loop<true, true, true, true>
+};
+
+// The execute loop for one combination of options. Verbose only happens in LOGGING builds and runs
+// every instruction through step() so each one gets logged. Trace runs blocks without fused pairs,
+// so every instruction gets a record with the address it used
+template <bool Stage2, bool Trace, bool Verbose, bool Breakpoint>
+void processor::execute_loop(unsigned int num) {
+  uint8_t load_rd = 0;  // for Verbose, which times one instruction at a time
+
   while (num > 0 && alive){
-    if (breakpoint_check && (pc == breakpoint)) {
-      cout << "Breakpoint reached at ";
-      show_pc();
-      clear_breakpoint();
-      return;
-    }
-    
-    if (stage2 == false) {
-      if (pc % 4 != 0) {
-        cout << "Error: misaligned pc" << endl;
-        num--;
-        continue;
+    if (pre_fetch_checks<Stage2>(num) == fetch_skip) continue;
+
+    if (Verbose) {
+      if (Breakpoint && breakpoint_set::at(breakpoints.in_block(pc), pc) && breakpoint_reached()) return;
+      uint64_t inst_pc = pc;
+      uint64_t count = instruction_count;
+      // fetched once here, so the log and the fetch TLB see one fetch per instruction
+      uint32_t inst = mem->fetch_word(inst_pc);
+      decoded_inst traced;
+      uint64_t address = 0;
+      if (Trace) {
+        decode(inst, traced);
+        address = reg[traced.rs1] + traced.imm;
       }
-    }
+      pc_changed = false;
+      step(inst);
 
-    // check for interrupts in order of priority
-    if ( (csr[csr::mstatus] & 0x8) || prv == 0) {
-      if (EXTRACT_BIT(csr[csr::mie], 11) & EXTRACT_BIT(csr[csr::mip], 11)) {
-        interrupt(rv64::interrupt::machine_external);
-      } 
-      else if (EXTRACT_BIT(csr[csr::mie], 3) & EXTRACT_BIT(csr[csr::mip], 3)) {
-        interrupt(rv64::interrupt::machine_software);
-      } 
-      else if (EXTRACT_BIT(csr[csr::mie], 7) & EXTRACT_BIT(csr[csr::mip], 7)) {
-        interrupt(rv64::interrupt::machine_timer);
+      instruction_count++;
+      increment_pc();
+      num--;
+      if (instruction_count != count) {
+        account_step(inst_pc, inst, load_rd);
+        if (Trace) trace_inst(traced, inst_pc, address);
       }
-      else if (EXTRACT_BIT(csr[csr::mie], 8) & EXTRACT_BIT(csr[csr::mip], 8)) {
-        interrupt(rv64::interrupt::user_external);
+      continue;
+    }
+
+    // run as much of the decoded block at the pc as we can. Interrupts only need checking above:
+    // the instructions that can make one deliverable (CSR writes, mret, traps) all end a block.
+    // Breakpoints only need checking here, since blocks end just before them
+    decoded_block* block = lookup_block(pc);
+    if (Breakpoint && block->breakpoint && breakpoint_reached()) return;
+    if (jit_engine != NULL && run_native(block, num)) continue;
+
+    const decoded_inst* di = block->insts.data();
+    const decoded_inst* end = di + block->insts.size();
+    uint64_t count = instruction_count;
+
+    while (Trace) {
+      pc_changed = false;
+      uint64_t inst_pc = pc;
+      uint64_t address = reg[di->rs1] + di->imm;
+      uint64_t before = instruction_count;
+      (this->*(kind_handlers[di->kind]))(*di);
+
+      // a trap takes the count back down
+      if (++instruction_count != before) trace_inst(*di, inst_pc, address);
+      increment_pc();
+      num--;
+      di++;
+
+      if (pc_changed || !alive || num == 0 || di == end) break;
+    }
+
+    while (!Trace) {
+      pc_changed = false;
+      unsigned int length = 1;
+
+      if (di->fused == rv64::no_fusion) {
+        (this->*(di->handler))(*di);
       }
-      else if ((csr[csr::mie] & 0x1) & (csr[csr::mip] & 0x1) ) {
-        interrupt(rv64::interrupt::user_software);
+      else if (num >= 2) {
+        (this->*(di->handler))(*di);
+        length = 2;
       }
-      else if (EXTRACT_BIT(csr[csr::mie], 4) & EXTRACT_BIT(csr[csr::mip], 4)) {
-        interrupt(rv64::interrupt::user_timer);
+      else {
+        // a fused pair that has to stop halfway, run its first instruction on its own
+        (this->*(kind_handlers[di->kind]))(*di);
       }
+
+      instruction_count += length;
+      increment_pc();
+      num -= length;
+      di += length;
+
+      if (pc_changed || !alive || num == 0 || di == end) break;
     }
-    
-    // check for pc alignment before fetch
+    account_block(block, instruction_count - count, pc);
+  };
+}
+
+bool processor::set_jit(bool enabled) {
+  if (!enabled) {
+    delete jit_engine;
+    jit_engine = NULL;
+    return true;
+  }
+  if (icache != NULL || predictor != NULL || profile_mix || pc_profiler != NULL || graph != NULL || tracer != NULL)
+    return false;
+  if (jit_engine == NULL) jit_engine = new jit();
+  if (!jit_engine->available()) {
+    delete jit_engine;
+    jit_engine = NULL;
+    return false;
+  }
+  // blocks decoded so far have no translations, which is all the JIT needs to start
+  return true;
+}
+
+// Everything that has to happen before an instruction is fetched at the pc, apart from breakpoints
+template <bool Stage2>
+processor::fetch_check processor::pre_fetch_checks(unsigned int& num) {
+  if (!Stage2) {
+    // no traps in stage 1, so no interrupts either
     if (pc % 4 != 0) {
-      // cout << "Error: misaligned pc" << endl;
-      exception(0, 0);
+      cout << "Error: misaligned pc" << endl;
       num--;
-      continue;
+      return fetch_skip;
     }
+    return fetch_ok;
+  }
 
-    pc_changed = false;
-    step();
-    
-    instruction_count++;
-    increment_pc();
+  // check for interrupts in order of priority
+  check_interrupts();
+  
+  // check for pc alignment before fetch
+  if (pc % 4 != 0) {
+    // cout << "Error: misaligned pc" << endl;
+    exception(0, 0);
     num--;
-  };
-  pc_changed = false;
+    return fetch_skip;
+  }
 
-  // this only runs when the program has finished executing
-  if (pc == breakpoint && !alive) {
-    cout << "Breakpoint reached at "; show_pc();
+  return fetch_ok;
+}
+
+processor::fetch_check processor::pre_fetch_checks(unsigned int& num) {
+  return stage2 ? pre_fetch_checks<true>(num) : pre_fetch_checks<false>(num);
+}
+
+// Called on entering a block that starts at a breakpoint. A breakpoint set with set_breakpoint()
+// always stops; the others stop when their condition holds and they have been hit often enough,
+// except at the pc execute() started from, so execution can carry on from one
+bool processor::breakpoint_reached() {
+  bool resuming = (pc == resume_pc);
+  resume_pc = NO_BREAKPOINT;
+
+  vector<breakpoint>* list = breakpoints.in_block(pc);
+  if (list == NULL) return false;
+
+  bool stop = false;
+  bool once = false;
+  for (size_t i = 0; i < list->size(); i++) {
+    breakpoint& b = (*list)[i];
+    if (b.address != pc) continue;
+    if (b.once) {
+      stop = once = true;
+      continue;
+    }
+    if (resuming) continue;
+    if (b.reg != NO_CONDITION && reg[b.reg] != b.value) continue;
+    if (++b.hits >= b.count) stop = true;
   }
-  vlog("Finished execution block at pc: " << std::hex << pc << std::endl);
+  if (!stop) return false;
+
+  at_breakpoint = true;
+  if (!quiet) {
+    cout << "Breakpoint reached at ";
+    show_pc();
+  }
+  if (once) {
+    breakpoints.remove_once();
+    flush_block_cache();
+  }
+  return true;
+}
+
+// Take the highest priority pending interrupt, if any are enabled
+bool processor::check_interrupts() {
+  uint64_t pending = irq_deliverable;
+  if (pending == 0) return false;
+  if (EXTRACT_BIT(pending, 11)) {
+    interrupt(rv64::interrupt::machine_external);
+  } 
+  else if (EXTRACT_BIT(pending, 3)) {
+    interrupt(rv64::interrupt::machine_software);
+  } 
+  else if (EXTRACT_BIT(pending, 7)) {
+    interrupt(rv64::interrupt::machine_timer);
+  }
+  else if (EXTRACT_BIT(pending, 8)) {
+    interrupt(rv64::interrupt::user_external);
+  }
+  else if (pending & 0x1) {
+    interrupt(rv64::interrupt::user_software);
+  }
+  else {
+    interrupt(rv64::interrupt::user_timer);
+  }
+  return true;
 }
 
 void processor::step() {
-  uint64_t inst = mem->read_doubleword(pc);
-  if (pc % 8 != 0) inst = inst >> 32;   // adjust for next instruction in the doubleword
+  step(mem->fetch_word(pc));
+}
+
+void processor::step(uint64_t inst) {
 
   uint8_t opcode = EXTRACT_OPCODE_FROM_INST(inst);
 
@@ -171,6 +401,7 @@ void processor::step() {
   uint8_t rs1;
   uint8_t rs2;
   uint8_t bA;
+  int slot;
   int64_t imm;
 
   uint64_t address;
@@ -364,6 +595,7 @@ void processor::step() {
               }
               else {
                 std::cout << "ecall: not implemented" << std::endl;
+                dropped++;
               }
             break;
 
@@ -406,11 +638,15 @@ void processor::step() {
 
                 // set machine privelage level
                 prv = 3;
+                update_interrupts();
                 // offsets
                 instruction_count--;
+                squashed++;
+                stall_events[rv64::trap_stall]++;
               }
               else {
                 std::cout << "ebreak: not implemented" << std::endl;
+                dropped++;
               }
 
             break;
@@ -422,6 +658,7 @@ void processor::step() {
               }
 
               update_pc(csr[csr::mepc]);
+              stall_events[rv64::mret_stall]++;
 
               if ( (csr[csr::mstatus] & 0x1800) == 0x1800) {
                 prv = 3;
@@ -429,6 +666,7 @@ void processor::step() {
               else {
                 prv = 0;
               }
+              // mstatus is written below, which brings irq_deliverable up to date with both
 
               // use the byteA buffer to store mpie
               bA = (csr[csr::mstatus] >> 7) % 2;
@@ -444,11 +682,9 @@ void processor::step() {
           }
         break;
 
-#define ENFORCE_PRIV_CHECK if( (prv == 0 || (valid_csr(imm) == false)) || \
-                               (imm == csr::mvendorid && rs1 != 0) || \
-                               (imm == csr::marchid && rs1 != 0) || \
-                               (imm == csr::mimpid && rs1 != 0) || \
-                               (imm == csr::mhartid && rs1 != 0) \
+#define ENFORCE_PRIV_CHECK slot = rv64::csr_slot_of(imm); \
+                           if (slot < 0 || prv < rv64::csr_table[slot].priv || \
+                               (rv64::csr_table[slot].read_only && rs1 != 0) \
                              ) \
                            { \
                              exception(rv64::except::illegal_instruction, inst); \
@@ -593,8 +829,10 @@ void processor::step() {
             if (stage2) {
             exception(rv64::except::load_address_misaligned, address);
             }
-            else if (address % 4 != 0) {
-              std::cout << "Error: misaligned address for ld" << std::endl;
+            else {
+              if (address % 4 != 0) std::cout << "Error: misaligned address for ld" << std::endl;
+              dropped++;
+              dropped_loads++;
             }
           }
         break;
@@ -719,7 +957,6 @@ void processor::step() {
       if (dwa == 0 && rd == 0 && rs1 == 0) {
         // this signals that the program has ended
         alive = false;
-        breakpoint = 0;
       }
 
       set_reg_m(rd, pc + 4);
@@ -874,15 +1111,61 @@ void processor::step() {
   
 }
 
+// Changing the breakpoints changes where blocks end, so the decoded blocks are thrown away
 void processor::clear_breakpoint() {
-  breakpoint = NO_BREAKPOINT;
+  breakpoints.clear();
+  flush_block_cache();
 }
 
 void processor::set_breakpoint(uint64_t addr) {
-  breakpoint = addr;
+  breakpoints.remove_once();
+  breakpoints.add(addr, true, NO_CONDITION, 0, 1);
+  flush_block_cache();
   vlog("Breakpoint set at " << std::hex << addr);
 }
 
+unsigned int processor::add_breakpoint(uint64_t address, int reg_num, uint64_t value, uint64_t count) {
+  unsigned int id = breakpoints.add(address, false, reg_num, value, count);
+  flush_block_cache();
+  vlog("Breakpoint " << std::dec << id << " added at " << std::hex << address);
+  return id;
+}
+
+bool processor::delete_breakpoint(unsigned int id) {
+  if (!breakpoints.remove(id)) return false;
+  flush_block_cache();
+  return true;
+}
+
+void processor::show_breakpoints() {
+  breakpoints.show(cout);
+}
+
+machine_snapshot* processor::take_snapshot(bool include_memory) {
+  machine_snapshot* s = new machine_snapshot;
+  s->pc = pc;
+  memcpy(s->reg, reg, sizeof(reg));
+  s->csr = csr;
+  s->prv = prv;
+  s->mem = include_memory ? mem->take_snapshot() : NULL;
+  return s;
+}
+
+void processor::restore_snapshot(const machine_snapshot* s) {
+  pc = s->pc;
+  memcpy(reg, s->reg, sizeof(reg));
+  csr = s->csr;
+  prv = s->prv;
+  update_interrupts();
+  // the memory's code generation moves on if anything decoded may have changed
+  if (s->mem != NULL) mem->restore_snapshot(s->mem);
+}
+
+void processor::free_snapshot(machine_snapshot* s) {
+  if (s->mem != NULL) mem->free_snapshot(s->mem);
+  delete s;
+}
+
 void processor::show_prv() {
   switch (prv) {
     case 0:
@@ -901,6 +1184,7 @@ void processor::set_prv(uint8_t prv) {
     case 0:
     case 3:
       this->prv = prv;
+      update_interrupts();
       break;
 
     default:
@@ -910,78 +1194,33 @@ void processor::set_prv(uint8_t prv) {
 }
 
 void processor::show_csr(unsigned int csr_num) {
-  switch (csr_num) {
-    case csr::mvendorid:
-    case csr::marchid:
-    case csr::mimpid:
-    case csr::mhartid:
-    case csr::mstatus:
-    case csr::misa:
-    case csr::mie:
-    case csr::mtvec:
-    case csr::mscratch:
-    case csr::mepc:
-    case csr::mcause:
-    case csr::mtval:
-    case csr::mip:
-      cout << setw(16) << setfill('0') << hex << csr[csr_num] << endl;
-      break;
-
-    default:
-      cout << "Illegal CSR number" << endl;
-      break;
+  if (rv64::csr_slot_of(csr_num) >= 0) {
+    cout << setw(16) << setfill('0') << hex << csr[csr_num] << endl;
+  }
+  else {
+    cout << "Illegal CSR number" << endl;
   }
-  
 }
 
 void processor::set_csr(unsigned int csr_num, uint64_t value) {
+  int slot = rv64::csr_slot_of(csr_num);
+  if (slot < 0) {
+    cout<<"Invalid CSR"<<endl;
+    return;
+  }
+  const rv64::csr_info& info = rv64::csr_table[slot];
+  if (info.read_only) {
+    cout<<"Illegal write to read-only CSR"<<endl;
+    return;
+  }
 
   // apply the writable bit rules to the input value
-  switch (csr_num) {
-    case csr::mstatus:
-      value = value & 0x1888;
-      value = value | 0x200000000;
-      break;
-    case csr::misa:
-      // ignore input, its a fixed value
-      value = 0x8000000000100100;
-      break;
-    case csr::mie:
-    case csr::mip:
-      value = value & 0x999;
-      break;
-    case csr::mtvec:
-      if (value & 0x1) {
-        // vectored mode
-        value = value & 0xffffffffffffff01;
-      } else {
-        // direct mode
-        value = value & 0xfffffffffffffffc;
-      }
-      break;
-    case csr::mepc:
-      value = value & 0xfffffffffffffffc;
-      break;
-    case csr::mcause:
-      value = value & 0x800000000000000f;
-      break;
-    case csr::mtval:
-    case csr::mscratch:
-      break;
-
-    case csr::mvendorid:
-    case csr::marchid:
-    case csr::mimpid:
-    case csr::mhartid:
-      cout<<"Illegal write to read-only CSR"<<endl;
-      return;
-
-    default:
-      cout<<"Invalid CSR"<<endl;
-      return;
+  if (slot == rv64::mtvec_s && (value & 0x1)) {
+    // vectored mode
+    value = value & 0xffffffffffffff01;
   }
-
-  csr[csr_num] = value;
+  csr.value[slot] = (value & info.write_mask) | info.fixed;
+  update_interrupts();
 }
 
 uint64_t processor::get_instruction_count() {
@@ -989,7 +1228,27 @@ uint64_t processor::get_instruction_count() {
 }
 
 uint64_t processor::get_cycle_count() {
-  return cycle_count;
+  uint64_t cycles = instruction_count - dropped;
+  for (int s = 0; s < rv64::num_stalls; s++)
+    cycles += get_stall_cycles(rv64::stall(s));
+  return cycles;
+}
+
+uint64_t processor::get_stall_cycles(rv64::stall reason) {
+  // the caches keep their own counts
+  uint64_t events = stall_events[reason];
+  if (reason == rv64::load_stall) events -= dropped_loads;
+  if (reason == rv64::icache_hit_stall) events = icache != NULL ? icache->hits : 0;
+  if (reason == rv64::icache_miss_stall) events = icache != NULL ? icache->misses : 0;
+  if (reason == rv64::dcache_hit_stall) events = dcache != NULL ? dcache->hits : 0;
+  if (reason == rv64::dcache_miss_stall) events = dcache != NULL ? dcache->misses : 0;
+  if (reason == rv64::branch_stall || reason == rv64::jump_stall) events = predictor_cycles ? 0 : events;
+  if (reason == rv64::mispredict_stall) events = predictor_cycles ? predictor->branch_misses + predictor->jump_misses : 0;
+
+  uint64_t cycles = events * pipeline.latency[reason];
+  // a trapping instruction's own cycle goes with the flush
+  if (reason == rv64::trap_stall) cycles += squashed;
+  return cycles;
 }
 
 void processor::exception(uint64_t cause, uint32_t inst) {
@@ -1041,6 +1300,18 @@ void processor::exception(uint64_t cause, uint32_t inst) {
   // adjustments
   instruction_count = instruction_count-1;
 
+  // a misaligned pc traps before anything is fetched, and an instruction that doesn't decode traps
+  // in the decode stage, before it has a cycle of its own. Anything else traps in place of an
+  // instruction, in the execute stage
+  stall_events[rv64::trap_stall]++;
+  if (cause == rv64::except::illegal_instruction) {
+    decoded_inst di;
+    decode(inst, di);
+    if (di.kind != rv64::illegal_k) squashed++;
+  }
+  else if (cause != rv64::except::pc_misaligned) squashed++;
+
+  update_interrupts();
 }
 
 void processor::interrupt(uint64_t cause) {
@@ -1055,6 +1326,7 @@ void processor::interrupt(uint64_t cause) {
 
   // set mcause to the cause of the interrupt
   set_csr(csr::mcause, 0x8000000000000000 + cause);
+  stall_events[rv64::interrupt_stall]++;
 
   // set mtvec to the address of the interrupt handler
   if (csr[csr::mtvec] & 0x1) {
@@ -1091,6 +1363,7 @@ void processor::interrupt(uint64_t cause) {
   // mie = 0b0
   // csr[csr::mstatus] = SET_BIT_U64(csr[csr::mstatus], 3, false);
   csr[csr::mstatus] = csr[csr::mstatus] & 0xfffffffffffffff7;
+  update_interrupts();
 
   switch(cause) {
     case rv64::interrupt::user_software:
@@ -14,11 +14,38 @@
 #include <unordered_map>
 #include "LogControl.h"
 #include "Definitions.h"
+#include "block_cache.h"
+#include "csr_file.h"
+#include "breakpoints.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "predictor.h"
+#include "profiler.h"
+#include "trace.h"
 
 using namespace std;
 
+// Instruction kinds first to last, as a mask with a bit for each kind (there are fewer than 64)
+#define KIND_RANGE(first, last) (((2ULL << rv64::last##_k) - 1) & ~((1ULL << rv64::first##_k) - 1))
+
+// Kinds that write rd, and kinds that load or store, for the trace
+#define TRACE_WRITE_KINDS \
+  ~(KIND_RANGE(fence, mret) | KIND_RANGE(sb, sd) | KIND_RANGE(beq, bgeu) | KIND_RANGE(illegal, illegal))
+#define TRACE_MEMORY_KINDS KIND_RANGE(lb, sd)
+
 #define NO_BREAKPOINT ~0ULL
 
+class jit;
+
+// Machine state captured by processor::take_snapshot()
+struct machine_snapshot {
+  uint64_t pc;
+  uint64_t reg[32];
+  csr_file csr;
+  uint8_t prv;
+  memory::snapshot* mem;   // NULL if memory wasn't included
+};
+
 class processor {
 
  private:
@@ -28,28 +55,178 @@ class processor {
 
   uint64_t pc;
   uint64_t reg[32];
-  uint64_t breakpoint;
+
+  // functionally for stage 2, kept next to the registers since interrupts are checked every block
+  uint8_t prv; // privilege level
+  csr_file csr; // the CSR registers, indexed by CSR number
+  uint64_t irq_deliverable; // mie & mip when interrupts are enabled, kept up to date by update_interrupts()
+
+  // Breakpoints are only checked when entering a decoded block, and decode_block() ends blocks
+  // just before them. resume_pc is where execute() started, so it can run off a breakpoint it stopped at
+  breakpoint_set breakpoints;
+  uint64_t resume_pc;
   uint64_t instruction_count;
-  uint64_t cycle_count;
+
+  // Timing model: how often each stall happened, and instructions that trapped, which take their
+  // cycle without retiring. Cycles are worked out from these when asked for, see get_cycle_count()
+  pipeline_config pipeline;
+  uint64_t stall_events[rv64::num_stalls];
+  uint64_t squashed;
+
+  // Stage 1 retires ecall, ebreak and a misaligned ld without carrying them out, and they take no
+  // cycles at all. dropped counts them, and dropped_loads the lds, whose load stall is taken back
+  uint64_t dropped;
+  uint64_t dropped_loads;
+
+  // L1 cache models, NULL when not wanted. The D-cache is attached to mem, which looks up every load
+  // and store in it. Fetches are looked up a block at a time by account_block()
+  cache* icache;
+  cache* dcache;
+
+  // Branch predictor model, NULL when not wanted. It sees the control transfer ending each block
+  // through account_block(). predictor_cycles charges its mispredictions instead of every taken
+  // branch and jump. branch_pcs has the counts for each pc, apart from those still in decoded blocks
+  branch_predictor* predictor;
+  bool predictor_cycles;
+  unordered_map<uint64_t, branch_stats> branch_pcs;
+  void predict_block(decoded_block* block, uint64_t n, uint64_t next_pc);
+  void fold_branch_stats();
+
+  // Instruction mix profile: executions of each rv64::inst_kind, apart from the runs of whole blocks
+  // still counted in decoded blocks. Only a block that stops early is counted an instruction at a time
+  bool profile_mix;
+  uint64_t inst_mix[rv64::num_inst_kinds];
+  void count_mix(const decoded_block* block, uint64_t n);
+  void fold_inst_mix();
+
+  // Sampling profiler, NULL when not wanted. It sees the calls and returns ending blocks through
+  // account_block(), which also samples once the instruction count reaches next_sample
+  profiler* pc_profiler;
+  uint64_t next_sample;
+  void take_samples(const decoded_block* block, uint64_t n);
+
+  // Call graph profiler, NULL when not wanted. account_block() shows it the calls and returns ending
+  // blocks, once their stalls have been counted
+  call_graph* graph;
+
+  // Binary trace of every retired instruction, NULL when not wanted. Tracing runs the handler loop
+  // an instruction at a time, see execute_loop()
+  trace_writer* tracer;
+
+  // Record di, which retired at inst_pc, in the trace. address is the one it loaded or stored at
+  inline void trace_inst(const decoded_inst& di, uint64_t inst_pc, uint64_t address) {
+    bool memory = (TRACE_MEMORY_KINDS >> di.kind) & 1;
+    bool write = di.rd != 0 && ((TRACE_WRITE_KINDS >> di.kind) & 1);
+    tracer->record(inst_pc, di.inst, write, reg[di.rd], memory, address);
+  }
 
   bool pc_changed;
   bool alive;
+  bool threaded; // run with execute_threaded() instead of the handler loop
+  bool quiet;    // no messages for breakpoints or the end of a program, for runs nobody is watching
+  bool at_breakpoint; // the last execute() stopped at a breakpoint
 
-  // functionally for stage 2:
-  uint8_t prv; // privilege level
-  // uint64_t csr[4096]; // the CSR registers
-  unordered_map<uint16_t, uint64_t> csr; // map csr's to their index
-  
+
+  // Decoded block cache, keyed by the pc of the first instruction in the block
+  unordered_map<uint64_t, decoded_block> block_cache;
+  uint64_t block_cache_generation; // memory code generation the cache was built against
+
+  // Translator for hot blocks, NULL when the JIT tier is off
+  jit* jit_engine;
 
   // Exception handling
   void exception(uint64_t cause, uint32_t inst);
 
   void interrupt(uint64_t cause);
 
+  // Interrupt and alignment checks made before each fetch.
+  // fetch_skip means the checks used up an instruction (a trap or misaligned pc) and should be rerun
+  enum fetch_check { fetch_ok, fetch_skip };
+  template <bool Stage2> fetch_check pre_fetch_checks(unsigned int& num);
+  fetch_check pre_fetch_checks(unsigned int& num);
+
+  // Check the breakpoints at the pc, reporting a stop. Returns true if execution should stop
+  bool breakpoint_reached();
+
+  // execute() loop, compiled once for each combination of stage 2, tracing, verbose logging and
+  // breakpoint checking so none of them are tested inside the loop
+  template <bool Stage2, bool Trace, bool Verbose, bool Breakpoint> void execute_loop(unsigned int num);
+  typedef void (processor::*execute_variant)(unsigned int num);
+  static const execute_variant execute_variants[16];
+
+  // Take the highest priority pending interrupt, if any are enabled. Returns true if one was taken
+  bool check_interrupts();
+
+  // True if check_interrupts() would take an interrupt
+  inline bool interrupt_pending() {
+    return irq_deliverable != 0;
+  }
+
+  // Recompute irq_deliverable. Needed after anything that changes mstatus, mie, mip or prv
+  inline void update_interrupts() {
+    irq_deliverable = ((csr.value[rv64::mstatus_s] & 0x8) || prv == 0)
+      ? (csr.value[rv64::mie_s] & csr.value[rv64::mip_s] & 0x999) : 0;
+  }
+
+  // Block cache
+  decoded_block* lookup_block(uint64_t address);
+  void decode_block(uint64_t address, decoded_block& block);
+  void decode(uint32_t inst, decoded_inst& di);
+  void flush_block_cache();
+  bool jit_ready(decoded_block* block);
+  bool run_native(decoded_block* block, unsigned int& num);
+
+  void fuse_block(decoded_block& block);
+  void count_stalls(decoded_block& block);
+
+  // Charge the timing model for the first n instructions of block, retired before carrying on at
+  // next_pc. Only a block that ran to its end can finish with a branch
+  inline void account_block(decoded_block* block, uint64_t n, uint64_t next_pc) {
+    if (n == 0) return;
+    const decoded_inst& last = block->insts[n - 1];
+    stall_events[rv64::load_stall] += last.loads;
+    stall_events[rv64::store_stall] += last.stores;
+    stall_events[rv64::load_use_stall] += last.load_uses;
+    stall_events[rv64::jump_stall] += last.jumps;
+    if (icache != NULL) icache->fetch_run(block->start_pc, n);
+    if (last.kind >= rv64::beq_k && last.kind <= rv64::bgeu_k && next_pc != block->start_pc + 4*n)
+      stall_events[rv64::branch_stall]++;
+    if (predictor != NULL && last.kind >= rv64::jal_k && last.kind <= rv64::bgeu_k)
+      predict_block(block, n, next_pc);
+    if (profile_mix) {
+      if (n == block->insts.size()) block->full_runs++;
+      else count_mix(block, n);
+    }
+    if (pc_profiler != NULL) {
+      if (instruction_count >= next_sample) take_samples(block, n);
+      if (last.kind == rv64::jal_k || last.kind == rv64::jalr_k)
+        pc_profiler->jump(block->start_pc + 4*(n - 1), last.rd, last.rs1, next_pc);
+    }
+    if (graph != NULL && (last.kind == rv64::jal_k || last.kind == rv64::jalr_k) &&
+        (is_call(last.rd) || is_return(last.rd, last.rs1)))
+      graph->jump(block->start_pc + 4*(n - 1), last.rd, last.rs1, next_pc, instruction_count, get_cycle_count());
+  }
+
+  // The same for one instruction, inst, run by step() at inst_pc. load_rd is the register loaded by
+  // the instruction before, or 0, and is updated for the next one
+  void account_step(uint64_t inst_pc, uint32_t inst, uint8_t& load_rd);
+
+  // Instruction handlers used by the block cache, one per rv64::inst_kind
+#define X(name) void op_##name(const decoded_inst& di);
+  RV64_INST_KINDS(X)
+#undef X
+  static const inst_handler kind_handlers[rv64::num_inst_kinds];
+
+  // Fused pair handlers, one per rv64::fusion. di is the first of the pair, (&di)[1] the second
+#define X(name) void fused_##name(const decoded_inst& di);
+  RV64_FUSIONS(X)
+#undef X
+
  public:
 
   // Consructor
   processor(memory* main_memory, bool verbose, bool stage2);
+  ~processor();
 
   // Display PC value
   void show_pc();
@@ -80,18 +257,133 @@ class processor {
     if (reg_num != 0) reg[reg_num] = new_value;
   }
 
-  // Execute a number of instructions
-  void execute(unsigned int num, bool breakpoint_check);
+  inline uint64_t get_reg(unsigned int reg_num) {
+    return reg[reg_num];
+  }
+
+  inline uint64_t get_pc() {
+    return pc;
+  }
+
+  // True if the last execute() stopped because the program jumped to 0 to end
+  inline bool program_ended() {
+    return !alive;
+  }
+
+  // True if the last execute() stopped at a breakpoint
+  inline bool stopped_at_breakpoint() {
+    return at_breakpoint;
+  }
+
+  // Don't report breakpoints or the end of a program, or leave the breakpoint at 0 that normally marks it
+  inline void set_quiet(bool quiet) {
+    this->quiet = quiet;
+  }
+
+  // Set this hart's mhartid
+  inline void set_hartid(uint64_t id) {
+    csr.value[rv64::mhartid_s] = id;
+  }
+
+  // Execute a number of instructions. A breakpoint at the pc doesn't stop it, since that's where the
+  // last run stopped, unless resume is false because this carries straight on from the last run
+  void execute(unsigned int num, bool breakpoint_check, bool resume = true);
+
+  // Execute a number of instructions using the direct-threaded core
+  void execute_threaded(unsigned int num, bool breakpoint_check);
+
+  // Choose the direct-threaded core for execute()
+  inline void set_threaded(bool threaded) {
+    this->threaded = threaded;
+  }
+
+  // Turn the JIT tier on or off. Returns false if it can't run on this host, or with an I-cache, branch
+  // predictor or profiling, since translated code goes from block to block without them seeing it
+  bool set_jit(bool enabled);
+
+  // Model L1 caches, replacing any there were. A size of 0 means no cache. An I-cache turns the JIT off
+  void set_caches(const cache_config& icache_config, const cache_config& dcache_config);
+
+  inline cache* get_icache() {
+    return icache;
+  }
+  inline cache* get_dcache() {
+    return dcache;
+  }
+
+  // Model a branch predictor, replacing any there was, or none if config isn't enabled. cycles
+  // charges mispredictions in the cycle count instead of taken branches and jumps. Turns the JIT off
+  void set_predictor(const predictor_config& config, bool cycles);
+
+  inline branch_predictor* get_predictor() {
+    return predictor;
+  }
+
+  // Branches and mispredictions at each pc that ends a block
+  const unordered_map<uint64_t, branch_stats>& get_branch_stats();
+
+  // Count the instructions executed by kind from now on, or stop. Turns the JIT off
+  void set_profile_mix(bool enabled);
+
+  inline bool get_profile_mix() {
+    return profile_mix;
+  }
+
+  // Executions of each rv64::inst_kind so far
+  const uint64_t* get_inst_mix();
+
+  // Sample the pc every interval instructions from now on, replacing any profile there was, or stop
+  // with an interval of 0. Turns the JIT off
+  void set_profiler(uint64_t interval);
+
+  inline profiler* get_profiler() {
+    return pc_profiler;
+  }
+
+  // Count the instructions and cycles of every call from now on, replacing any call graph there was,
+  // or stop. Turns the JIT off
+  void set_call_graph(bool enabled);
+
+  inline call_graph* get_call_graph() {
+    return graph;
+  }
+
+  // Write a binary trace of every instruction retired from now on to path, closing any trace there
+  // was, or just close it if path is empty. Turns the JIT off. Returns false, with a message, if the
+  // file can't be written
+  bool set_trace(const string& path);
 
   // Execute a single instruction at the PC - a step through the program
   void step();
 
-  // Clear breakpoint
+  // The same for inst, already fetched from the PC
+  void step(uint64_t inst);
+
+  // Clear all breakpoints
   void clear_breakpoint();
 
-  // Set breakpoint at an address
+  // Set breakpoint at an address. It replaces the last one set this way and is cleared when reached
   void set_breakpoint(uint64_t address);
 
+  // Add a breakpoint that stays until deleted. It stops when reached with x[reg] == value (any value
+  // for NO_CONDITION), from the count'th time on. Returns its id
+  unsigned int add_breakpoint(uint64_t address, int reg, uint64_t value, uint64_t count);
+
+  // Delete a breakpoint by id. Returns false if there's no such breakpoint
+  bool delete_breakpoint(unsigned int id);
+
+  // List the breakpoints
+  void show_breakpoints();
+
+  // Capture pc, registers, CSRs, privilege level and guest memory. Memory is shared copy-on-write,
+  // see memory::take_snapshot(). Free it with free_snapshot()
+  machine_snapshot* take_snapshot(bool include_memory = true);
+
+  // Go back to a snapshot. Breakpoints and the instruction count are left as they are
+  void restore_snapshot(const machine_snapshot* s);
+
+  void free_snapshot(machine_snapshot* s);
+
   // Show privilege level
   // Empty implementation for stage 1, required for stage 2
   void show_prv();
@@ -110,9 +402,18 @@ class processor {
 
   uint64_t get_instruction_count();
 
-  // Used for Postgraduate assignment. Undergraduate assignment can return 0.
+  // Cycles the instructions so far would take on an in-order 5-stage pipeline: one for each
+  // instruction retired or trapped, plus the stalls
   uint64_t get_cycle_count();
 
+  // Cycles lost to one stall reason
+  uint64_t get_stall_cycles(rv64::stall reason);
+
+  // Latencies for the timing model. Counts so far are kept, and priced at the new latencies
+  inline void set_pipeline(const pipeline_config& config) {
+    pipeline = config;
+  }
+
 };
 
 #endif
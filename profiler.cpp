@@ -0,0 +1,215 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for profiler and call_graph
+
+**************************************************************** */
+
+#include <sstream>
+
+#include "profiler.h"
+
+using namespace std;
+
+profiler::profiler(uint64_t interval) {
+  this->interval = interval;
+  untracked = 0;
+  sample_count = 0;
+}
+
+// Fold value into hash, a step of 64 bit FNV-1a on the whole word
+static inline uint64_t mix(uint64_t hash, uint64_t value) {
+  return (hash ^ value) * 0x100000001B3ULL;
+}
+
+bool profiler::same_stack(const vector<uint64_t>& key, uint64_t pc) {
+  if (key.size() != stack.size() + (stack.empty() ? 1 : 2) || key.back() != pc) return false;
+  if (stack.empty()) return true;
+  if (key[0] != stack[0].call_pc) return false;
+  for (size_t i = 0; i < stack.size(); i++)
+    if (key[i + 1] != stack[i].function) return false;
+  return true;
+}
+
+void profiler::sample(uint64_t pc) {
+  sample_count++;
+  uint64_t hash = mix(stack.empty() ? 0xCBF29CE484222325ULL : stack.back().hash, pc);
+  while (true) {
+    auto it = samples.find(hash);
+    if (it == samples.end()) break;
+    if (same_stack(it->second.key, pc)) {
+      it->second.count++;
+      return;
+    }
+    hash++;
+  }
+
+  stack_samples& s = samples[hash];
+  if (!stack.empty()) s.key.push_back(stack[0].call_pc);
+  for (size_t i = 0; i < stack.size(); i++) s.key.push_back(stack[i].function);
+  s.key.push_back(pc);
+  s.count = 1;
+}
+
+void profiler::jump(uint64_t pc, uint8_t rd, uint8_t rs1, uint64_t target) {
+  if (is_call(rd)) {
+    if (stack.size() < PROFILE_MAX_DEPTH) {
+      frame f;
+      f.call_pc = pc;
+      f.function = target;
+      f.hash = mix(stack.empty() ? mix(0xCBF29CE484222325ULL, pc) : stack.back().hash, target);
+      stack.push_back(f);
+    }
+    else {
+      untracked++;
+    }
+  }
+  else if (is_return(rd, rs1)) {
+    if (untracked > 0) {
+      untracked--;
+      return;
+    }
+    // usually the innermost call, but a frame may have been left without a return
+    for (size_t i = stack.size(); i > 0; i--) {
+      if (stack[i - 1].call_pc + 4 == target) {
+        stack.resize(i - 1);
+        return;
+      }
+    }
+  }
+}
+
+string function_name(const symbol_table& symbols, uint64_t address) {
+  const symbol* sym = symbols.find(address);
+  if (sym != NULL) return sym->name;
+  stringstream name;
+  name << "0x" << hex << address;
+  return name.str();
+}
+
+map<string, uint64_t> profiler::collapsed(const symbol_table& symbols) {
+  map<string, uint64_t> stacks;
+  unordered_map<uint64_t, string> names_seen;   // deep stacks name the same few addresses over and over
+  for (auto it = samples.begin(); it != samples.end(); ++it) {
+    const vector<uint64_t>& key = it->second.key;
+    string names;
+    const string* last = NULL;
+    for (size_t i = 0; i < key.size(); i++) {
+      auto seen = names_seen.find(key[i]);
+      if (seen == names_seen.end())
+        seen = names_seen.insert(make_pair(key[i], function_name(symbols, key[i]))).first;
+      const string& name = seen->second;
+      // the sampled pc is usually in the function called last
+      if (i + 1 == key.size() && last != NULL && name == *last) break;
+      if (i != 0) names += ';';
+      names += name;
+      last = &name;
+    }
+    stacks[names] += it->second.count;
+  }
+  return stacks;
+}
+
+call_graph::call_graph(uint64_t instructions, uint64_t cycles) {
+  start_instructions = instructions;
+  start_cycles = cycles;
+  root = 0;
+  untracked = 0;
+}
+
+void call_graph::leave(uint64_t instructions, uint64_t cycles, unordered_map<uint64_t, call_stats>& functions,
+                       map<call_edge, call_stats>& edges, vector<frame>& stack) {
+  const frame& f = stack.back();
+  uint64_t caller = stack.size() > 1 ? stack[stack.size() - 2].function : root;
+  uint64_t inclusive_instructions = instructions - f.entry_instructions;
+  uint64_t inclusive_cycles = cycles - f.entry_cycles;
+
+  call_stats& function = functions[f.function];
+  function.self_instructions += inclusive_instructions - f.child_instructions;
+  function.self_cycles += inclusive_cycles - f.child_cycles;
+  if (--function.active == 0) {
+    function.instructions += inclusive_instructions;
+    function.cycles += inclusive_cycles;
+  }
+  call_stats& edge = edges[call_edge(caller, f.function)];
+  edge.self_instructions += inclusive_instructions - f.child_instructions;
+  edge.self_cycles += inclusive_cycles - f.child_cycles;
+  if (--edge.active == 0) {
+    edge.instructions += inclusive_instructions;
+    edge.cycles += inclusive_cycles;
+  }
+
+  stack.pop_back();
+  if (!stack.empty()) {
+    stack.back().child_instructions += inclusive_instructions;
+    stack.back().child_cycles += inclusive_cycles;
+  }
+}
+
+void call_graph::jump(uint64_t pc, uint8_t rd, uint8_t rs1, uint64_t target, uint64_t instructions, uint64_t cycles) {
+  if (is_call(rd)) {
+    if (stack.size() >= PROFILE_MAX_DEPTH) {
+      untracked++;
+      return;
+    }
+    if (root == 0) root = pc;
+    uint64_t caller = stack.empty() ? root : stack.back().function;
+    frame f;
+    f.call_pc = pc;
+    f.function = target;
+    f.entry_instructions = instructions;
+    f.entry_cycles = cycles;
+    f.child_instructions = 0;
+    f.child_cycles = 0;
+    stack.push_back(f);
+
+    call_stats& function = functions[target];
+    function.calls++;
+    function.active++;
+    call_stats& edge = edges[call_edge(caller, target)];
+    edge.calls++;
+    edge.active++;
+  }
+  else if (is_return(rd, rs1)) {
+    if (untracked > 0) {
+      untracked--;
+      return;
+    }
+    for (size_t i = stack.size(); i > 0; i--) {
+      if (stack[i - 1].call_pc + 4 != target) continue;
+      // frames left without a return end here too
+      while (stack.size() >= i)
+        leave(instructions, cycles, functions, edges, stack);
+      return;
+    }
+  }
+}
+
+void call_graph::totals(uint64_t instructions, uint64_t cycles, unordered_map<uint64_t, call_stats>& function_totals,
+                        map<call_edge, call_stats>& edge_totals) {
+  function_totals = functions;
+  edge_totals = edges;
+  vector<frame> open = stack;
+  uint64_t outermost_instructions = 0;
+  uint64_t outermost_cycles = 0;
+  for (auto it = edges.begin(); it != edges.end(); ++it) {
+    if (it->first.first != root) continue;
+    outermost_instructions += it->second.instructions;
+    outermost_cycles += it->second.cycles;
+  }
+  while (!open.empty()) {
+    if (open.size() == 1) {
+      outermost_instructions += instructions - open[0].entry_instructions;
+      outermost_cycles += cycles - open[0].entry_cycles;
+    }
+    leave(instructions, cycles, function_totals, edge_totals, open);
+  }
+
+  // the function that made the outermost calls, or everything if there weren't any
+  call_stats& outside = function_totals[root];
+  outside.instructions = instructions - start_instructions;
+  outside.cycles = cycles - start_cycles;
+  outside.self_instructions += outside.instructions - outermost_instructions;
+  outside.self_cycles += outside.cycles - outermost_cycles;
+}
@@ -0,0 +1,139 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Profilers for guest code: pc sampling and an exact call graph
+
+**************************************************************** */
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+#include "symbols.h"
+
+using namespace std;
+
+// Retired instructions between samples by default. Prime, so it doesn't keep landing on the same
+// instruction of a loop
+#define PROFILE_INTERVAL 10007
+
+// Calls deeper than this aren't tracked, a sample in one goes to the deepest frame that is
+#define PROFILE_MAX_DEPTH 1024
+
+// Calls and returns are found from the jumps that end blocks: jal or jalr writing ra (or t0) is a call,
+// and jalr x0 through ra (or t0) a return to whichever open call it matches
+inline bool is_call(uint8_t rd) {
+  return rd == 1 || rd == 5;
+}
+inline bool is_return(uint8_t rd, uint8_t rs1) {
+  return rd == 0 && (rs1 == 1 || rs1 == 5);
+}
+
+// Name of the function holding address, or the address itself if no symbol covers it
+string function_name(const symbol_table& symbols, uint64_t address);
+
+// Samples the pc every interval retired instructions, along with the calls it is inside. Samples are
+// kept as raw addresses and only turned into function names, from whatever symbols there are by then,
+// when asked for
+class profiler {
+
+  struct frame {
+    uint64_t call_pc;
+    uint64_t function;      // where the call went
+    uint64_t hash;          // of the calls up to this one, so a sample needn't look at the whole stack
+  };
+
+  struct stack_samples {
+    vector<uint64_t> key;   // the pc of the outermost call, each function called, then the pc sampled
+    uint64_t count;
+  };
+
+  uint64_t interval;
+  vector<frame> stack;      // outermost call first
+  unsigned int untracked;   // calls past PROFILE_MAX_DEPTH still to return
+
+  // keyed by the hash of the stack and pc, the next free key on a collision
+  unordered_map<uint64_t, stack_samples> samples;
+  bool same_stack(const vector<uint64_t>& key, uint64_t pc);
+
+ public:
+
+  uint64_t sample_count;
+
+  profiler(uint64_t interval);
+
+  inline uint64_t get_interval() {
+    return interval;
+  }
+
+  // Record a sample at pc
+  void sample(uint64_t pc);
+
+  // The jal or jalr at pc, with its rd and rs1, went to target
+  void jump(uint64_t pc, uint8_t rd, uint8_t rs1, uint64_t target);
+
+  // Samples by stack, function names outermost first separated by ;, as flame graph tools read them.
+  // A function without a symbol is named by its address
+  map<string, uint64_t> collapsed(const symbol_table& symbols);
+};
+
+// Instructions and cycles for a function or a call from one function to another. Inclusive counts
+// take in everything called, and only count once for a recursive function or call
+struct call_stats {
+  uint64_t calls;
+  uint64_t self_instructions;
+  uint64_t instructions;
+  uint64_t self_cycles;
+  uint64_t cycles;
+  unsigned int active;    // calls still open, only the outermost adds its inclusive counts
+};
+
+typedef pair<uint64_t, uint64_t> call_edge;   // caller and callee function addresses
+
+// Exact counts for every call, from a shadow stack that notes the instruction and cycle counts when
+// each call is made and takes them away again when it returns. Instructions outside any call go to
+// the function that made the first one, whose address is where it made it from
+class call_graph {
+
+  struct frame {
+    uint64_t call_pc;
+    uint64_t function;
+    uint64_t entry_instructions;
+    uint64_t entry_cycles;
+    uint64_t child_instructions;  // inclusive counts of the calls it has made that have returned
+    uint64_t child_cycles;
+  };
+
+  uint64_t start_instructions;
+  uint64_t start_cycles;
+  uint64_t root;            // pc of the first outermost call, 0 until there is one
+  vector<frame> stack;      // outermost call first
+  unsigned int untracked;   // calls past PROFILE_MAX_DEPTH still to return
+  unordered_map<uint64_t, call_stats> functions;
+  map<call_edge, call_stats> edges;
+
+  // Close the innermost frame at these counts, adding it to functions and edges
+  void leave(uint64_t instructions, uint64_t cycles, unordered_map<uint64_t, call_stats>& functions,
+             map<call_edge, call_stats>& edges, vector<frame>& stack);
+
+ public:
+
+  // Count from when the hart has run instructions in cycles
+  call_graph(uint64_t instructions, uint64_t cycles);
+
+  // The call or return at pc, with its rd and rs1, went to target once the hart had run instructions
+  // in cycles
+  void jump(uint64_t pc, uint8_t rd, uint8_t rs1, uint64_t target, uint64_t instructions, uint64_t cycles);
+
+  // The counts so far, as though every open call returned now at instructions and cycles
+  void totals(uint64_t instructions, uint64_t cycles, unordered_map<uint64_t, call_stats>& function_totals,
+              map<call_edge, call_stats>& edge_totals);
+};
+
+#endif
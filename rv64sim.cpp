@@ -14,7 +14,10 @@
 
 #include "memory.h"
 #include "processor.h"
+#include "harts.h"
 #include "commands.h"
+#include "sweep.h"
+#include "batch.h"
 
 #include "LogControl.h"
 #include <filesystem>
@@ -33,14 +36,42 @@ int main(int argc, char* argv[]) {
     // Values of command line options. 
     string arg;
     string testPath;
+    string elfPath;
     bool verbose = false;
     bool cycle_reporting = false;
     bool stage2 = false;
+    bool threaded = false;
+    bool use_jit = false;
+    bool memory_stats = false;
+    bool stall_stats = false;
+    pipeline_config pipeline;
+    cache_config icache;
+    cache_config dcache;
+    predictor_config predictor;
+    bool predictor_cycles = false;
+    bool profile_mix = false;
+    string mixPath;
+    uint64_t profile_interval = 0;
+    string flamePath;
+    string symbolsPath;
+    bool call_graph = false;
+    string tracePath;
+    uint64_t ram_base = 0;
+    uint64_t ram_size = 0;
+    string sweepPath;
+    string batchPath;
+    string benchPath;
+    string baselinePath;
+    unsigned int bench_repeat = 0;
+    string resultsPath;
+    unsigned int sweep_jobs = 0;
+    uint64_t sweep_limit = 1000000000ULL;
+    unsigned int hart_count = 1;
+    unsigned int quantum = DEFAULT_QUANTUM;
 
     memory* main_memory;
-    processor* cpu;
+    hart_group* harts;
 
-    unsigned long int cpu_instruction_count;
 
     for (int i = 1; i < argc; i++) {
 	// Process the next option
@@ -51,6 +82,119 @@ int main(int argc, char* argv[]) {
 	    cycle_reporting = true;
 	else if (arg == "-s2")  // Stage 2 functionality enabled
 	    stage2 = true;
+	else if (arg == "--threaded")  // Use the direct-threaded interpreter core
+	    threaded = true;
+	else if (arg == "--jit")  // Translate hot blocks to host code
+	    use_jit = true;
+	else if (arg == "--mem-stats")  // Report guest memory use on exit
+	    memory_stats = true;
+	else if (arg == "--stalls")  // Report where the cycles went on exit
+	    stall_stats = true;
+	else if (arg == "--pipeline" && i + 1 < argc) {  // Latencies for the cycle count
+	    pipeline.load(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--icache" && i + 1 < argc) {  // L1 I-cache: --icache size,ways,line[,replacement]
+	    icache.parse(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--dcache" && i + 1 < argc) {  // L1 D-cache: --dcache size,ways,line[,replacement[,back|through]]
+	    dcache.parse(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--bpred" && i + 1 < argc) {  // Branch predictor: --bpred bimodal|gshare|tage[,table_bits[,btb[,ras]]]
+	    predictor.parse(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--bpred-cycles")  // Charge mispredictions in the cycle count instead of taken branches and jumps
+	    predictor_cycles = true;
+	else if (arg == "--profile-mix")  // Report the instructions executed by kind on exit
+	    profile_mix = true;
+	else if (arg == "--profile-mix-json" && i + 1 < argc) {  // The same, also written to a JSON file
+	    profile_mix = true;
+	    mixPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--profile")  // Sample the pc and report the hottest functions on exit
+	    profile_interval = PROFILE_INTERVAL;
+	else if (arg == "--profile-interval" && i + 1 < argc) {  // The same, sampling every so many instructions
+	    profile_interval = strtoull(argv[i+1], NULL, 0);
+	    i++;
+	}
+	else if (arg == "--profile-flame" && i + 1 < argc) {  // The same, also writing collapsed stacks for a flame graph
+	    if (profile_interval == 0) profile_interval = PROFILE_INTERVAL;
+	    flamePath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--call-graph")  // Report instructions and cycles by function and call on exit
+	    call_graph = true;
+	else if (arg == "--trace" && i + 1 < argc) {  // Write a binary trace of every instruction, for rv64trace
+	    tracePath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--symbols" && i + 1 < argc) {  // Name functions in reports from an objdump -d listing
+	    symbolsPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--ram" && i + 1 < argc) {  // Contiguous RAM region: --ram base,size
+	    char* end;
+	    ram_base = strtoull(argv[i+1], &end, 0);
+	    ram_size = (*end == ',') ? strtoull(end + 1, &end, 0) : 0;
+	    if (ram_size == 0 || *end != '\0') {
+		cout << argv[0] << ": Bad RAM region: " << argv[i+1] << endl;
+		ram_base = 0;
+		ram_size = 0;
+	    }
+	    i++;
+	}
+	else if (arg == "--elf" && i + 1 < argc) {  // Load an ELF executable before reading commands
+	    elfPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--sweep" && i + 1 < argc) {  // Run the loaded program once per row of a CSV file
+	    sweepPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--bench" && i + 1 < argc) {  // Time the tests listed in a manifest file
+	    benchPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--repeat" && i + 1 < argc) {  // Runs of each --bench test
+	    bench_repeat = strtoul(argv[i+1], NULL, 10);
+	    i++;
+	}
+	else if (arg == "--baseline" && i + 1 < argc) {  // Earlier --bench results to compare with
+	    baselinePath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--results" && i + 1 < argc) {  // Where --sweep or --bench writes its results
+	    resultsPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--batch" && i + 1 < argc) {  // Run the tests listed in a manifest file
+	    batchPath = string(argv[i+1]);
+	    i++;
+	}
+	else if (arg == "--jobs" && i + 1 < argc) {  // Workers for --sweep and --batch
+	    sweep_jobs = strtoul(argv[i+1], NULL, 10);
+	    i++;
+	}
+	else if (arg == "--limit" && i + 1 < argc) {  // Instructions per --sweep run
+	    sweep_limit = strtoull(argv[i+1], NULL, 0);
+	    i++;
+	}
+	else if (arg == "--harts" && i + 1 < argc) {  // Harts sharing the memory
+	    hart_count = strtoul(argv[i+1], NULL, 10);
+	    if (hart_count == 0) {
+		cout << argv[0] << ": Bad hart count: " << argv[i+1] << endl;
+		hart_count = 1;
+	    }
+	    i++;
+	}
+	else if (arg == "--quantum" && i + 1 < argc) {  // Instructions each hart runs between synchronisations
+	    quantum = strtoul(argv[i+1], NULL, 10);
+	    i++;
+	}
 	else if (arg == "--testHex"){
 	    testPath = string(argv[i+1]);
         i++;
@@ -61,26 +205,97 @@ int main(int argc, char* argv[]) {
 	}
     }
 
+    if (batchPath != "" || benchPath != "") {
+        // every test has a machine of its own
+        batch_options options;
+        options.manifest = batchPath != "" ? batchPath : benchPath;
+        options.jobs = sweep_jobs;
+        options.verbose = verbose;
+        options.cycle_reporting = cycle_reporting;
+        options.memory_stats = memory_stats;
+        options.stall_stats = stall_stats;
+        options.pipeline = pipeline;
+        options.icache = icache;
+        options.dcache = dcache;
+        options.predictor = predictor;
+        options.predictor_cycles = predictor_cycles;
+        options.profile_mix = profile_mix;
+        options.profile_interval = profile_interval;
+        options.call_graph = call_graph;
+        options.stage2 = stage2;
+        options.threaded = threaded;
+        options.jit = use_jit;
+        options.ram_base = ram_base;
+        options.ram_size = ram_size;
+        options.repeat = bench_repeat;
+        options.results = resultsPath != "" ? resultsPath : "bench_results.json";
+        options.baseline = baselinePath;
+        if (batchPath != "")
+            return run_batch(options) ? 0 : 1;
+        return run_bench(options) ? 0 : 1;
+    }
+    if (sweepPath != "" && hart_count > 1) {
+        cout << "--sweep runs a single hart" << endl;
+        hart_count = 1;
+    }
     main_memory = new memory (verbose);
-    cpu = new processor (main_memory, verbose, stage2);
+    if (ram_size != 0 && hart_count > 1) {
+        // the harts' copy-on-write views work on pages, which a RAM region doesn't have
+        cout << "RAM region not mapped, it needs a single hart" << endl;
+    }
+    else if (ram_size != 0 && !main_memory->map_ram(ram_base, ram_size)) {
+        cout << "Can't map RAM region, base and size must be multiples of " << dec << blockSize << endl;
+    }
+    harts = new hart_group (main_memory, hart_count, verbose, stage2, quantum);
+    harts->set_threaded(threaded);
+    harts->set_pipeline(pipeline);
+    harts->set_caches(icache, dcache);
+    harts->set_predictor(predictor, predictor_cycles);
+    harts->set_profile_mix(profile_mix);
+    harts->set_profiler(profile_interval);
+    harts->set_call_graph(call_graph);
+    if (tracePath != "")
+        harts->set_trace(tracePath);
+    if (use_jit && (icache.size != 0 || predictor.enabled || profile_mix || profile_interval != 0 || call_graph ||
+                    tracePath != "")) {
+        cout << "JIT not used with an I-cache, branch predictor, profiling or tracing" << endl;
+    }
+    else if (use_jit && !harts->set_jit(true)) {
+        cout << "JIT not available on this host" << endl;
+    }
     if (testPath != "") {
         uint64_t start_address;
         if (main_memory->load_file(testPath, start_address))
-            cpu->set_pc(start_address);
+            harts->set_pc(start_address);
     }
-    interpret_commands(main_memory, cpu, verbose);
-
-    // Report final statistics
-
-    cpu_instruction_count = cpu->get_instruction_count();
-    cout << "Instructions executed: " << dec << cpu_instruction_count << endl;
-
-    if (cycle_reporting) {
-        // Required for postgraduate Computer Architecture course
-        unsigned long int cpu_cycle_count;
-
-        cpu_cycle_count = cpu->get_cycle_count();
-
-        cout << "CPU cycle count: " << dec << cpu_cycle_count << endl;
+    if (elfPath != "") {
+        uint64_t start_address;
+        if (main_memory->load_elf(elfPath, start_address))
+            harts->set_pc(start_address);
+    }
+    if (sweepPath != "") {
+        // runs happen on their own machines, so there is nothing to report for this one
+        sweep_options options;
+        options.rows = sweepPath;
+        options.results = resultsPath != "" ? resultsPath : "sweep_results.csv";
+        options.jobs = sweep_jobs;
+        options.limit = sweep_limit;
+        options.stage2 = stage2;
+        options.threaded = threaded;
+        options.jit = use_jit;
+        options.ram_base = ram_base;
+        options.ram_size = ram_size;
+        return run_sweep(harts->hart(0), options) ? 0 : 1;
     }
+    interpret_commands(main_memory, harts, verbose, cin);
+    if (tracePath != "")
+        harts->set_trace("");
+    // loading a hex file clears the symbols, so a listing for it is read once it has run
+    if (symbolsPath != "")
+        main_memory->load_symbols(symbolsPath);
+    report_statistics(main_memory, harts, cycle_reporting, memory_stats, stall_stats);
+    if (mixPath != "")
+        write_inst_mix_json(harts, mixPath);
+    if (flamePath != "")
+        write_flame_graph(main_memory, harts, flamePath);
 }
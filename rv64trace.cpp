@@ -0,0 +1,159 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Trace decoder: prints a --trace file in the verbose log's format
+
+**************************************************************** */
+
+#include <iostream>
+#include <string>
+#include <cinttypes>
+#include <cstdio>
+#include <stdlib.h>
+
+#include "Bits.h"
+#include "trace.h"
+
+using namespace std;
+
+// Write the line the verbose log gives an instruction after fetching it to line, which has room for
+// the longest
+static void describe(uint32_t inst, char* line, size_t size) {
+  unsigned int rd = EXTRACT_RD_FROM_INST(inst);
+  unsigned int rs1 = EXTRACT_RS1_FROM_INST(inst);
+  unsigned int rs2 = EXTRACT_RS2_FROM_INST(inst);
+  unsigned int funct3 = EXTRACT_FUNCT3_FROM_INST(inst);
+  unsigned int funct7 = EXTRACT_FUNCT7_FROM_INST(inst);
+  uint64_t immed_I = EXTRACT_IMM12_FROM_INST(inst);
+
+  switch (EXTRACT_OPCODE_FROM_INST(inst)) {
+    case 0x37:
+    case 0x17:
+      snprintf(line, size, "%s: rd = %u, immed_U = %016" PRIx64, inst & 0x20 ? "lui" : "auipc", rd,
+               (uint64_t)(int64_t)(int32_t)(inst & 0xFFFFF000));
+      break;
+
+    case 0x13:
+    case 0x1B: {
+      static const char* const names[8] = { "addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi" };
+      bool word = inst & 0x08;
+      const char* name = funct3 == 5 && (funct7 & 0x20) ? "srai" : names[funct3];
+      if (funct3 == 1 || funct3 == 5)
+        snprintf(line, size, "%s%s: rd = %u, rs1 = %u, shamt = %u", name, word ? "w" : "", rd, rs1,
+                 (unsigned int)(word ? EXTRACT_SHAMT32_FROM_INST(inst) : EXTRACT_SHAMT64_FROM_INST(inst)));
+      else
+        snprintf(line, size, "%s%s: rd = %u, rs1 = %u, immed_I = %016" PRIx64, name, word ? "w" : "", rd, rs1,
+                 immed_I);
+      break;
+    }
+
+    case 0x33:
+    case 0x3B: {
+      static const char* const names[8] = { "add", "sll", "slt", "sltu", "xor", "srl", "or", "and" };
+      const char* name = names[funct3];
+      if (funct3 == 0 && (funct7 & 0x20)) name = "sub";
+      if (funct3 == 5 && (funct7 & 0x20)) name = "sra";
+      snprintf(line, size, "%s%s: rd = %u, rs1 = %u, rs2 = %u", name, inst & 0x08 ? "w" : "", rd, rs1, rs2);
+      break;
+    }
+
+    case 0x03: {
+      static const char* const names[8] = { "lb", "lh", "lw", "ld", "lbu", "lhu", "lwu", "?" };
+      snprintf(line, size, "%s: rd = %u, rs1 = %u, immed_I = %016" PRIx64, names[funct3], rd, rs1, immed_I);
+      break;
+    }
+
+    case 0x23: {
+      static const char* const names[8] = { "sb", "sh", "sw", "sd", "?", "?", "?", "?" };
+      snprintf(line, size, "%s: rs1 = %u, rs2 = %u, immed_S = %016" PRIx64, names[funct3], rs1, rs2,
+               (uint64_t)EXTRACT_STORE_OFFSET_FROM_INST(inst));
+      break;
+    }
+
+    case 0x63: {
+      static const char* const names[8] = { "beq", "bne", "?", "?", "blt", "bge", "bltu", "bgeu" };
+      snprintf(line, size, "%s: rs1 = %u, rs2 = %u, immed_B = %016" PRIx64, names[funct3], rs1, rs2,
+               (uint64_t)EXTRACT_BRANCH_OFFSET_FROM_INST(inst));
+      break;
+    }
+
+    case 0x6F:
+      snprintf(line, size, "jal: rd = %u, immed_J = %016" PRIx64, rd, (uint64_t)(int64_t)EXTRACT_JAL_OFFSET_FROM_INST(inst));
+      break;
+
+    case 0x67:
+      snprintf(line, size, "jalr: rd = %u, rs1 = %u, immed_I = %016" PRIx64, rd, rs1, immed_I);
+      break;
+
+    case 0x0F:
+      snprintf(line, size, "fence: no operation");
+      break;
+
+    case 0x73: {
+      static const char* const names[8] = { "?", "csrrw", "csrrs", "csrrc", "?", "csrrwi", "csrrsi", "csrrci" };
+      if (funct3 == 0)
+        snprintf(line, size, "%s", inst == 0x00100073 ? "ebreak" : inst == 0x30200073 ? "mret" : "ecall");
+      else if (funct3 & 4)
+        snprintf(line, size, "%s: rd = %u, uimm = %02x, csr_num = %03x", names[funct3], rd, rs1, inst >> 20);
+      else
+        snprintf(line, size, "%s: rd = %u, rs1 = %u, csr_num = %03x", names[funct3], rd, rs1, inst >> 20);
+      break;
+    }
+
+    default:
+      snprintf(line, size, "illegal instruction");
+      break;
+  }
+}
+
+static void usage(const char* program) {
+  cout << "Usage: " << program << " [--from pc] [--to pc] trace_file" << endl
+       << "Prints the instructions in a trace written by rv64sim --trace, those with from <= pc < to if given," << endl
+       << "each with the value written to its rd and the address it loaded or stored at" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  string path;
+  uint64_t from = 0;
+  uint64_t to = ~0ULL;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--from" && i + 1 < argc)
+      from = strtoull(argv[++i], NULL, 0);
+    else if (arg == "--to" && i + 1 < argc)
+      to = strtoull(argv[++i], NULL, 0);
+    else if (path == "" && arg[0] != '-')
+      path = arg;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (path == "") {
+    usage(argv[0]);
+    return 1;
+  }
+
+  trace_reader reader;
+  if (!reader.open(path)) return 1;
+  trace_record record;
+  // the same word is mostly seen over and over, so keep the last line made for each slot
+  static uint32_t described[TRACE_INST_SLOTS];
+  static char descriptions[TRACE_INST_SLOTS][96];
+  while (reader.next(record)) {
+    if (record.pc < from || record.pc >= to) continue;
+    unsigned int slot = (record.pc >> 2) & (TRACE_INST_SLOTS - 1);
+    if (described[slot] != record.inst || descriptions[slot][0] == 0) {
+      describe(record.inst, descriptions[slot], sizeof(descriptions[slot]));
+      described[slot] = record.inst;
+    }
+    printf("Fetch: pc = %016" PRIx64 ", ir = %08x\n%s\n", record.pc, record.inst, descriptions[slot]);
+    if (record.memory) printf("Memory access: address = %016" PRIx64 "\n", record.address);
+    if (record.write)
+      printf("Register write: rd = %u, data = %016" PRIx64 "\n", EXTRACT_RD_FROM_INST(record.inst), record.value);
+  }
+  fflush(stdout);
+  return 0;
+}
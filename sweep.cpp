@@ -0,0 +1,224 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Parameter sweep runner
+
+**************************************************************** */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "memory.h"
+#include "processor.h"
+#include "sweep.h"
+
+using namespace std;
+
+// What a CSV column overrides
+struct sweep_column {
+  enum { reg_column, pc_column, memory_column } kind;
+  unsigned int reg_num;
+  uint64_t address;
+};
+
+struct sweep_row {
+  unsigned int line;          // in the CSV file, for messages
+  vector<bool> present;       // one per column, false for an empty cell
+  vector<uint64_t> values;
+};
+
+struct sweep_result {
+  uint64_t x10;
+  uint64_t instructions;
+  bool ended;                 // the program ended, rather than running out of instructions
+};
+
+// Split a CSV line into cells with the surrounding whitespace trimmed
+static vector<string> sweep_cells(const string& line) {
+  vector<string> cells;
+  stringstream in(line);
+  string cell;
+  while (getline(in, cell, ',')) {
+    size_t first = cell.find_first_not_of(" \t\r");
+    size_t last = cell.find_last_not_of(" \t\r");
+    cells.push_back(first == string::npos ? "" : cell.substr(first, last - first + 1));
+  }
+  if (!line.empty() && line[line.length() - 1] == ',')
+    cells.push_back("");
+  return cells;
+}
+
+// A hex number, with or without 0x
+static bool sweep_hex(const string& cell, uint64_t& value) {
+  size_t start = (cell.length() > 2 && cell[0] == '0' && tolower(cell[1]) == 'x') ? 2 : 0;
+  if (start == cell.length())
+    return false;
+  for (size_t i = start; i < cell.length(); i++)
+    if (!isxdigit(cell[i])) return false;
+  value = strtoull(cell.c_str() + start, NULL, 16);
+  return true;
+}
+
+static bool sweep_header(const string& cell, sweep_column& column) {
+  if (cell == "pc") {
+    column.kind = sweep_column::pc_column;
+    return true;
+  }
+  if (cell.length() > 1 && cell[0] == 'x') {
+    char* end;
+    column.kind = sweep_column::reg_column;
+    column.reg_num = strtoul(cell.c_str() + 1, &end, 10);
+    return isdigit(cell[1]) && *end == '\0' && column.reg_num <= 31;
+  }
+  if (cell.length() > 1 && cell[0] == 'm') {
+    size_t start = cell.find_first_not_of(" \t", 1);
+    column.kind = sweep_column::memory_column;
+    // memory is written a whole doubleword at a time, which an unaligned address would miss
+    return start != string::npos && sweep_hex(cell.substr(start), column.address) && column.address % 8 == 0;
+  }
+  return false;
+}
+
+static bool sweep_read(const string& path, vector<sweep_column>& columns, vector<sweep_row>& rows) {
+  ifstream in(path.c_str());
+  if (!in) {
+    cout << "Can't open sweep file " << path << endl;
+    return false;
+  }
+
+  string line;
+  unsigned int line_number = 0;
+  bool have_header = false;
+  while (getline(in, line)) {
+    line_number++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == string::npos || line[first] == '#')
+      continue;
+    vector<string> cells = sweep_cells(line);
+
+    if (!have_header) {
+      have_header = true;
+      columns.resize(cells.size());
+      for (size_t i = 0; i < cells.size(); i++) {
+        if (!sweep_header(cells[i], columns[i])) {
+          cout << path << ":" << dec << line_number << ": Unknown column " << cells[i] << endl;
+          return false;
+        }
+      }
+      continue;
+    }
+
+    if (cells.size() > columns.size()) {
+      cout << path << ":" << dec << line_number << ": More cells than columns" << endl;
+      return false;
+    }
+    sweep_row row;
+    row.line = line_number;
+    row.present.assign(columns.size(), false);
+    row.values.assign(columns.size(), 0);
+    for (size_t i = 0; i < cells.size(); i++) {
+      if (cells[i].empty())
+        continue;
+      if (!sweep_hex(cells[i], row.values[i])) {
+        cout << path << ":" << dec << line_number << ": Bad value " << cells[i] << endl;
+        return false;
+      }
+      row.present[i] = true;
+    }
+    rows.push_back(row);
+  }
+  return true;
+}
+
+// One worker thread: a processor and memory of its own, taking rows until there are none left
+static void sweep_worker(const sweep_options& options, const machine_snapshot* start,
+                         const vector<sweep_column>& columns, const vector<sweep_row>& rows,
+                         atomic<size_t>& next_row, vector<sweep_result>& results) {
+  memory mem(false);
+  if (options.ram_size != 0)
+    mem.map_ram(options.ram_base, options.ram_size);
+  processor cpu(&mem, false, options.stage2);
+  cpu.set_quiet(true);
+  cpu.set_threaded(options.threaded);
+  if (options.jit)
+    cpu.set_jit(true);
+
+  for (size_t r = next_row++; r < rows.size(); r = next_row++) {
+    const sweep_row& row = rows[r];
+    cpu.restore_snapshot(start);
+    for (size_t i = 0; i < columns.size(); i++) {
+      if (!row.present[i])
+        continue;
+      if (columns[i].kind == sweep_column::reg_column)
+        cpu.set_reg(columns[i].reg_num, row.values[i]);
+      else if (columns[i].kind == sweep_column::pc_column)
+        cpu.set_pc(row.values[i]);
+      else
+        mem.write_doubleword(columns[i].address, row.values[i], ~0ULL);
+    }
+
+    // execute() takes an unsigned int, so long limits go in pieces
+    uint64_t before = cpu.get_instruction_count();
+    uint64_t remaining = options.limit;
+    bool ended = false;
+    while (remaining > 0 && !ended) {
+      unsigned int chunk = remaining > 0x40000000 ? 0x40000000 : (unsigned int)remaining;
+      cpu.execute(chunk, false);
+      remaining -= chunk;
+      ended = cpu.program_ended();
+    }
+
+    results[r].x10 = cpu.get_reg(10);
+    results[r].instructions = cpu.get_instruction_count() - before;
+    results[r].ended = ended;
+  }
+}
+
+bool run_sweep(processor* cpu, const sweep_options& options) {
+  vector<sweep_column> columns;
+  vector<sweep_row> rows;
+  if (!sweep_read(options.rows, columns, rows))
+    return false;
+
+  unsigned int jobs = options.jobs;
+  if (jobs == 0)
+    jobs = thread::hardware_concurrency();
+  if (jobs == 0)
+    jobs = 1;
+  if (jobs > rows.size())
+    jobs = rows.size() > 0 ? rows.size() : 1;
+
+  // every run starts from here, with the pages shared between all the workers until written
+  machine_snapshot* start = cpu->take_snapshot();
+  vector<sweep_result> results(rows.size());
+  atomic<size_t> next_row(0);
+  vector<thread> workers;
+  for (unsigned int i = 0; i < jobs; i++)
+    workers.push_back(thread(sweep_worker, cref(options), start, cref(columns), cref(rows),
+                             ref(next_row), ref(results)));
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+  cpu->free_snapshot(start);
+
+  ofstream out(options.results.c_str());
+  if (!out) {
+    cout << "Can't write sweep results to " << options.results << endl;
+    return false;
+  }
+  out << "line,x10,instructions,exit" << endl;
+  for (size_t r = 0; r < rows.size(); r++) {
+    out << dec << rows[r].line << "," << setw(16) << setfill('0') << hex << results[r].x10 << ","
+        << dec << results[r].instructions << "," << (results[r].ended ? "end" : "limit") << endl;
+  }
+
+  cout << dec << rows.size() << " runs on " << jobs << " threads, results in " << options.results << endl;
+  return true;
+}
@@ -0,0 +1,38 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Parameter sweep: many runs of one loaded program
+
+**************************************************************** */
+
+#include <string>
+#include <cstdint>
+
+#include "processor.h"
+
+using namespace std;
+
+struct sweep_options {
+  string rows;          // CSV of overrides, one run per row
+  string results;       // CSV written with the outcome of each run
+  unsigned int jobs;    // worker threads, 0 for one per host CPU
+  uint64_t limit;       // instructions each run may execute
+  bool stage2;
+  bool threaded;
+  bool jit;
+  uint64_t ram_base;    // RAM region for each worker, ram_size 0 for none
+  uint64_t ram_size;
+};
+
+// Run the program in cpu once for each row of options.rows, every run starting from cpu's current state
+// with the row's overrides applied. The header row names what each column sets: x<n>, pc, or
+// m <address> for the aligned doubleword of memory there. Values are hex and an empty cell leaves that one alone.
+// Each worker thread has its own processor and memory, sharing unwritten pages with cpu's memory.
+// Returns false if the rows can't be read or the results can't be written
+bool run_sweep(processor* cpu, const sweep_options& options);
+
+#endif
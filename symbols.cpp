@@ -0,0 +1,49 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for the symbol table
+
+**************************************************************** */
+
+#include "symbols.h"
+
+void symbol_table::clear() {
+  symbols.clear();
+}
+
+void symbol_table::add(uint64_t address, uint64_t size, bool function, const string& name) {
+  auto it = symbols.find(address);
+  if (it != symbols.end()) {
+    // prefer a function over a plain label at the same address
+    if (it->second.function || !function)
+      return;
+  }
+  symbol s;
+  s.address = address;
+  s.size = size;
+  s.function = function;
+  s.name = name;
+  symbols[address] = s;
+}
+
+const symbol* symbol_table::find(uint64_t address) const {
+  auto it = symbols.upper_bound(address);
+  if (it == symbols.begin())
+    return NULL;
+  --it;
+  const symbol& s = it->second;
+  if (s.size != 0 && address - s.address >= s.size)
+    return NULL;
+  return &s;
+}
+
+bool symbol_table::lookup(const string& name, uint64_t& address) const {
+  for (auto it = symbols.begin(); it != symbols.end(); ++it) {
+    if (it->second.name == name) {
+      address = it->first;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,51 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Symbol table kept from a loaded ELF file
+
+**************************************************************** */
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+using namespace std;
+
+struct symbol {
+  uint64_t address;
+  uint64_t size;      // 0 if the ELF file didn't give one
+  bool function;
+  string name;
+};
+
+class symbol_table {
+
+ private:
+
+  map<uint64_t, symbol> symbols;   // keyed by address, first symbol at an address wins
+
+ public:
+
+  void clear();
+  void add(uint64_t address, uint64_t size, bool function, const string& name);
+
+  // Symbol covering address: the closest one at or below it, as long as address is inside its size
+  // (or it has no size). NULL if there isn't one
+  const symbol* find(uint64_t address) const;
+
+  // Address of a symbol by name. Returns false if there's no such symbol
+  bool lookup(const string& name, uint64_t& address) const;
+
+  inline bool empty() const {
+    return symbols.empty();
+  }
+  inline size_t size() const {
+    return symbols.size();
+  }
+};
+
+#endif
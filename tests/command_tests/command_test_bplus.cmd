@@ -0,0 +1,27 @@
+# loop: addi x10, x10, 1; jal x0, -4
+m 00001000 = ffdff06f00150513
+pc = 1000
+
+b + 1004 x10 == 5
+b + 1000 hit 3
+b ?
+. 100   # stops the third time round, not at the start
+x10
+. 100
+x10
+pc
+
+b - 2
+b - 9
+b 1000
+b ?
+. 100   # stops straight away
+pc
+. 100   # at 1004 once x10 is 5
+x10
+pc
+
+b
+b ?
+. 10
+x10
@@ -0,0 +1,7 @@
+# a single hart: hart 0 is the only one to select
+hart
+hart 1
+hart 0
+hart
+x10 = 7
+x10
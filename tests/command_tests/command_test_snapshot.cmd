@@ -0,0 +1,29 @@
+# loop: addi x10, x10, 1; sd x10, 0(x0); jal x0, -8
+m 00001000 = 00a0302300150513
+m 00001008 = 00000000ff9ff06f
+pc = 1000
+x10 = 100
+snapshot
+. 30
+x10
+m 0
+pc
+
+restore
+x10
+m 0
+pc
+
+# a store over the code is undone too
+m 00001000 = 00a0302300250513
+. 3
+x10
+restore
+. 3
+x10
+
+snapshot 1
+x10 = 5
+restore 2
+restore 1
+x10
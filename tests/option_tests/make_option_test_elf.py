@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Writes option_test_elf.elf, the ELF fixture for option_test_elf, without needing a RISC-V toolchain:
+# the code of compiled_test_leaf at 0, as its Makefile links it, and a data segment at 0x10000 with
+# 8 bytes of file data followed by 24 bytes of .bss. A symbol table names the three functions.
+
+import struct
+
+def read_hex(path):
+    code = bytearray()
+    for line in open(path):
+        line = line.strip()
+        if not line.startswith(':') or line[7:9] != '00':
+            continue
+        count, address = int(line[1:3], 16), int(line[3:7], 16)
+        code[address:address + count] = bytes.fromhex(line[9:9 + 2*count])
+    return bytes(code)
+
+code = read_hex('../compiled_tests/compiled_test_leaf.hex')
+data = struct.pack('<Q', 0x1122334455667788)
+DATA_ADDR, DATA_MEMSZ = 0x10000, 32
+
+strtab = b'\0_start\0leaf_example\0main\0'
+shstrtab = b'\0.text\0.data\0.bss\0.symtab\0.strtab\0.shstrtab\0'
+def name(table, s):
+    return table.index(s.encode() + b'\0')
+
+def sym(n, value, size, info, shndx):
+    return struct.pack('<IBBHQQ', n, info, 0, shndx, value, size)
+FUNC = (1 << 4) | 2   # STB_GLOBAL, STT_FUNC
+symtab = sym(0, 0, 0, 0, 0) + sym(name(strtab, '_start'), 0x00, 0x14, FUNC, 1) \
+       + sym(name(strtab, 'leaf_example'), 0x14, 0x6c, FUNC, 1) + sym(name(strtab, 'main'), 0x80, 0x7c, FUNC, 1)
+
+EHDR, PHDR, SHDR = 64, 56, 64
+off_code = EHDR + 2*PHDR
+off_data = off_code + len(code)
+off_symtab = (off_data + len(data) + 7) & ~7
+off_strtab = off_symtab + len(symtab)
+off_shstrtab = off_strtab + len(strtab)
+off_shdr = (off_shstrtab + len(shstrtab) + 7) & ~7
+
+out = bytearray()
+out += b'\x7fELF' + bytes([2, 1, 1]) + bytes(9)                          # ELF64, little-endian
+out += struct.pack('<HHIQQQIHHHHHH', 2, 243, 1, 0, EHDR, off_shdr, 0,   # ET_EXEC, EM_RISCV, entry 0
+                   EHDR, PHDR, 2, SHDR, 7, 6)
+out += struct.pack('<IIQQQQQQ', 1, 5, off_code, 0, 0, len(code), len(code), 4)        # PT_LOAD r-x
+out += struct.pack('<IIQQQQQQ', 1, 6, off_data, DATA_ADDR, DATA_ADDR, len(data), DATA_MEMSZ, 4)
+out += code + data
+out += bytes(off_symtab - len(out)) + symtab + strtab + shstrtab
+out += bytes(off_shdr - len(out))
+
+def shdr(n, kind, flags, addr, offset, size, link=0, info=0, align=1, entsize=0):
+    return struct.pack('<IIQQQQIIQQ', n, kind, flags, addr, offset, size, link, info, align, entsize)
+out += shdr(0, 0, 0, 0, 0, 0)
+out += shdr(name(shstrtab, '.text'), 1, 6, 0, off_code, len(code), align=4)
+out += shdr(name(shstrtab, '.data'), 1, 3, DATA_ADDR, off_data, len(data), align=8)
+out += shdr(name(shstrtab, '.bss'), 8, 3, DATA_ADDR + len(data), off_data + len(data), DATA_MEMSZ - len(data), align=8)
+out += shdr(name(shstrtab, '.symtab'), 2, 0, 0, off_symtab, len(symtab), link=5, info=1, align=8, entsize=24)
+out += shdr(name(shstrtab, '.strtab'), 3, 0, 0, off_strtab, len(strtab))
+out += shdr(name(shstrtab, '.shstrtab'), 3, 0, 0, off_shstrtab, len(shstrtab))
+
+open('option_test_elf.elf', 'wb').write(out)
@@ -0,0 +1,6 @@
+# the gshare predictor's report on compiled_test_quicksort
+l "../compiled_tests/compiled_test_quicksort.hex"
+b 0
+.
+. 99999999
+x10
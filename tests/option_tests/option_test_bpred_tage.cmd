@@ -0,0 +1,6 @@
+# the tage predictor's report on compiled_test_fib
+l "../compiled_tests/compiled_test_fib.hex"
+b 0
+.
+. 99999999
+x10
@@ -0,0 +1,6 @@
+# fib's calls and the instructions and cycles in each function
+l "../compiled_tests/compiled_test_fib.hex"
+b 0
+.
+. 99999999
+x10
@@ -0,0 +1,5 @@
+# the call graph named from the symbol table of an ELF file
+b 0
+.
+. 99999999
+x10
@@ -0,0 +1,6 @@
+# quicksort's calls, with functions reached from more than one caller
+l "../compiled_tests/compiled_test_quicksort.hex"
+b 0
+.
+. 99999999
+x10
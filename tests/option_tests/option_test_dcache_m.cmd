@@ -0,0 +1,9 @@
+# m commands go around the D-cache model: only the ld is looked up, and misses
+#   1000: ld a0, 0x100(x0)
+m 100 = 1234
+m 100
+m 1000 = 0000001310003503
+pc = 1000
+.
+x10
+m 100
@@ -0,0 +1,17 @@
+# --elf loaded compiled_test_leaf's code at 0, a data doubleword at 10000 and 24 bytes of .bss after it
+pc
+m 10000
+m 10008
+# loading it again zeroes the .bss, which has no data in the file, and nothing past it
+m 10008 = ffffffffffffffff
+m 10018 = ffffffffffffffff
+m 10020 = ffffffffffffffff
+l "option_test_elf.elf"
+m 10000
+m 10008
+m 10018
+m 10020
+b 0
+.
+. 99999999
+x10
@@ -0,0 +1,2 @@
+# --elf only takes ELF files
+pc
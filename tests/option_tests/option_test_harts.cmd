@@ -0,0 +1,15 @@
+# two harts, two quanta. Each stores 1 - mhartid to the same doubleword:
+#   1000: csrr a0, mhartid
+#   1004: xori a1, a0, 1
+#   1008: sd a1, 0x200(x0)
+# hart 1 stores the value memory already held, and as the later hart its store wins
+m 1000 = 00154593f1402573
+m 1008 = 0000001320b03023
+pc = 1000
+hart 1
+pc = 1000
+. 3
+m 200
+x11
+hart 0
+x11
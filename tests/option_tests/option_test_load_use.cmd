@@ -0,0 +1,6 @@
+# cycles for sort with a load-use bubble, and the stalls they went to
+l "../compiled_tests/compiled_test_sort.hex"
+b 0
+.
+. 99999999
+x10
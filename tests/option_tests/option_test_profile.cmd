@@ -0,0 +1,6 @@
+# the flat profile and flame graph stacks of compiled_test_fib, with names from its listing
+l "../compiled_tests/compiled_test_fib.hex"
+b 0
+.
+. 99999999
+x10
@@ -0,0 +1,6 @@
+# the instruction mix of compiled_test_fib, as text and JSON
+l "../compiled_tests/compiled_test_fib.hex"
+b 0
+.
+. 99999999
+x10
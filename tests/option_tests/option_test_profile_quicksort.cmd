@@ -0,0 +1,6 @@
+# the flat profile of compiled_test_quicksort, sampled every 1009 instructions
+l "../compiled_tests/compiled_test_quicksort.hex"
+b 0
+.
+. 99999999
+x10
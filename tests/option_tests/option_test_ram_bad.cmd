@@ -0,0 +1,3 @@
+# a --ram region that doesn't parse maps nothing, so the store takes a page
+m 100 = 5
+m 100
@@ -0,0 +1,6 @@
+# the threaded core running translated blocks
+l "../compiled_tests/compiled_test_quicksort.hex"
+b 0
+.
+. 99999999
+x10
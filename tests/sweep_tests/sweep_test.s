@@ -0,0 +1,14 @@
+	# Program for the sweep tests: a0 = a0 + a1 + the doubleword at 0x100
+
+	.text
+	.globl	_start
+_start:
+	ld	a2, 0x100(zero)
+	add	a0, a0, a1
+	add	a0, a0, a2
+	jr	zero
+
+	.org	0x20
+	# a row that starts here never ends
+spin:
+	j	spin
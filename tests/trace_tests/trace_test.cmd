@@ -0,0 +1,4 @@
+l "trace_test.hex"
+. 100
+x10
+m 300
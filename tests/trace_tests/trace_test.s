@@ -0,0 +1,32 @@
+	# Program for the trace tests: stores 1 to 4 in an array, calls sum to add them up, and stores
+	# the total at 0x300
+
+	.text
+	.globl	_start
+_start:
+	li	t0, 0x200
+	li	t1, 1
+	li	t2, 5
+fill:
+	sd	t1, 0(t0)
+	addi	t0, t0, 8
+	addi	t1, t1, 1
+	bne	t1, t2, fill
+	lui	t3, 0x80000		# a value far from the last in t3, for a long delta
+	li	a0, 0x200
+	li	a1, 4
+	jal	sum
+	sd	a0, 0x300(zero)
+	jr	zero
+
+	# a0 = the sum of the a1 doublewords from a0
+sum:
+	li	t0, 0
+loop:
+	ld	t1, 0(a0)
+	add	t0, t0, t1
+	addi	a0, a0, 8
+	addi	a1, a1, -1
+	bnez	a1, loop
+	mv	a0, t0
+	ret
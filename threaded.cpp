@@ -0,0 +1,373 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Direct-threaded interpreter core
+
+**************************************************************** */
+
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+#include "memory.h"
+#include "processor.h"
+#include "block_cache.h"
+#include "Definitions.h"
+#include "LogControl.h"
+
+using namespace std;
+
+#if defined(__GNUC__)
+
+// Labels as values are a GNU extension
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Runs the same decoded blocks as execute(), but jumps straight from one instruction body to the
+// next through a table of label addresses instead of calling a handler and returning to a loop.
+// pc and the register file live in locals and are only written back when something outside this
+// function needs them: the pre-fetch checks, the fallback handlers and the end of the run.
+void processor::execute_threaded(unsigned int num, bool breakpoint_check) {
+  // indexed by decoded_inst::op: every instruction kind, then every fused pair
+  static const void* const dispatch[rv64::num_inst_kinds + rv64::num_fusions - 1] = {
+#define X(name) &&do_##name,
+    RV64_INST_KINDS(X)
+#undef X
+#define X(name) &&fused_##name,
+    RV64_FUSIONS(X)
+#undef X
+  };
+
+  uint64_t x[32];
+  uint64_t lpc = pc;
+  memory* m = mem;
+  const decoded_inst* di = NULL;
+  const decoded_inst* end = NULL;
+  uint64_t address;
+
+  // the block being run, and the instruction count it started at, for the timing model
+  decoded_block* running = NULL;
+  uint64_t block_count = 0;
+
+  memcpy(x, reg, sizeof(x));
+  this->alive = true;
+
+// write the locals back before anything that looks at processor state
+#define SYNC_OUT pc = lpc; memcpy(reg, x, sizeof(x));
+#define SYNC_IN lpc = pc; memcpy(x, reg, sizeof(x));
+
+// retire the current instruction and fall through to the next one in the block
+#define NEXT \
+  instruction_count++; \
+  lpc += 4; \
+  num--; \
+  if (num == 0 || ++di == end) goto block_entry; \
+  goto *dispatch[di->op];
+
+// run a fused pair as one instruction only if it can't be cut in half by the budget
+#define FUSED_CHECK \
+  if (num < 2) goto *dispatch[di->kind];
+
+// retire both instructions of a fused pair
+#define NEXT2 \
+  instruction_count += 2; \
+  lpc += 8; \
+  num -= 2; \
+  di += 2; \
+  if (num == 0 || di == end) goto block_entry; \
+  goto *dispatch[di->op];
+
+// retire a control transfer, which always ends the block
+#define JUMP(target) \
+  instruction_count++; \
+  lpc = (target) - ((target) % 2); \
+  num--; \
+  goto block_entry;
+
+// hand the instruction to its processor::op_ handler, then start a new block
+#define FALLBACK \
+  SYNC_OUT; \
+  pc_changed = false; \
+  (this->*(kind_handlers[di->kind]))(*di); \
+  instruction_count++; \
+  increment_pc(); \
+  num--; \
+  SYNC_IN; \
+  goto block_entry;
+
+#define RD x[di->rd]
+#define RS1 x[di->rs1]
+#define RS2 x[di->rs2]
+#define IMM di->imm
+
+block_entry:
+  x[0] = 0;
+  if (running != NULL) {
+    account_block(running, instruction_count - block_count, lpc);
+    running = NULL;
+  }
+  if (num == 0 || !alive) goto done;
+
+  pc = lpc;
+  {
+    fetch_check check = pre_fetch_checks(num);
+    lpc = pc;
+    if (check == fetch_skip) goto block_entry;
+  }
+
+  {
+    decoded_block* block = lookup_block(lpc);
+    if (breakpoint_check && block->breakpoint) {
+      // a condition may need the registers
+      memcpy(reg, x, sizeof(x));
+      if (breakpoint_reached()) return;
+    }
+    // a translated block runs on the processor's registers, so only hot blocks pay for the copies
+    if (jit_engine != NULL && jit_ready(block)) {
+      SYNC_OUT;
+      bool ran = run_native(block, num);
+      SYNC_IN;
+      if (ran) goto block_entry;
+    }
+    di = block->insts.data();
+    end = di + block->insts.size();
+    running = block;
+    block_count = instruction_count;
+  }
+  goto *dispatch[di->op];
+
+do_lui:   RD = IMM; x[0] = 0; NEXT;
+do_auipc: RD = lpc + IMM; x[0] = 0; NEXT;
+
+do_addi:  RD = RS1 + IMM; x[0] = 0; NEXT;
+do_slti:  RD = (int64_t)RS1 < IMM; x[0] = 0; NEXT;
+do_sltiu: RD = RS1 < (uint64_t)IMM; x[0] = 0; NEXT;
+do_xori:  RD = RS1 ^ IMM; x[0] = 0; NEXT;
+do_ori:   RD = RS1 | IMM; x[0] = 0; NEXT;
+do_andi:  RD = RS1 & IMM; x[0] = 0; NEXT;
+do_slli:  RD = RS1 << di->rs2; x[0] = 0; NEXT;
+do_srli:  RD = RS1 >> di->rs2; x[0] = 0; NEXT;
+do_srai:  RD = (int64_t)RS1 >> di->rs2; x[0] = 0; NEXT;
+
+do_add:   RD = RS1 + RS2; x[0] = 0; NEXT;
+do_sub:   RD = RS1 - RS2; x[0] = 0; NEXT;
+do_sll:   RD = RS1 << (RS2 & 0x3F); x[0] = 0; NEXT;
+do_slt:   RD = (int64_t)RS1 < (int64_t)RS2; x[0] = 0; NEXT;
+do_sltu:  RD = RS1 < RS2; x[0] = 0; NEXT;
+do_xor:   RD = RS1 ^ RS2; x[0] = 0; NEXT;
+do_srl:   RD = RS1 >> (RS2 & 0x3F); x[0] = 0; NEXT;
+do_sra:   RD = (int64_t)RS1 >> (RS2 & 0x3F); x[0] = 0; NEXT;
+do_or:    RD = RS1 | RS2; x[0] = 0; NEXT;
+do_and:   RD = RS1 & RS2; x[0] = 0; NEXT;
+
+do_fence: NEXT;
+
+do_ecall:
+do_ebreak:
+do_mret:
+do_csrrw:
+do_csrrs:
+do_csrrc:
+do_csrrwi:
+do_csrrsi:
+do_csrrci:
+do_illegal:
+  FALLBACK;
+
+do_lb:
+  address = RS1 + IMM;
+  RD = (int64_t)(int8_t)(m->read_doubleword(address) >> ((address % 8) * 8));
+  x[0] = 0; NEXT;
+
+do_lbu:
+  address = RS1 + IMM;
+  RD = (m->read_doubleword(address) >> ((address % 8) * 8)) & 0xFF;
+  x[0] = 0; NEXT;
+
+do_lh:
+  address = RS1 + IMM;
+  if (address % 2 != 0) { FALLBACK; }
+  RD = (int64_t)(int16_t)(m->read_doubleword(address) >> ((address % 8) * 8));
+  x[0] = 0; NEXT;
+
+do_lhu:
+  address = RS1 + IMM;
+  if (address % 2 != 0) { FALLBACK; }
+  RD = (m->read_doubleword(address) >> ((address % 8) * 8)) & 0xFFFF;
+  x[0] = 0; NEXT;
+
+do_lw:
+  address = RS1 + IMM;
+  if (address % 4 != 0) { FALLBACK; }
+  RD = (int64_t)(int32_t)m->read_word(address);
+  x[0] = 0; NEXT;
+
+do_lwu:
+  address = RS1 + IMM;
+  if (address % 4 != 0) { FALLBACK; }
+  RD = m->read_word(address);
+  x[0] = 0; NEXT;
+
+do_ld:
+  address = RS1 + IMM;
+  if (address % 8 != 0) { FALLBACK; }
+  RD = m->read_doubleword(address);
+  x[0] = 0; NEXT;
+
+// a store onto decoded code ends the block so the next lookup sees the new instructions
+#define STORE_DONE \
+  if (m->get_code_generation() != block_cache_generation) { \
+    JUMP(lpc + 4); \
+  } \
+  NEXT;
+
+do_sb:
+  m->write_byte(RS1 + IMM, RS2, 0xFF);
+  STORE_DONE;
+
+do_sh:
+  address = RS1 + IMM;
+  if (address % 2 != 0) { FALLBACK; }
+  m->write_half(address, RS2, 0xFFFF);
+  STORE_DONE;
+
+do_sw:
+  address = RS1 + IMM;
+  if (address % 4 != 0) { FALLBACK; }
+  m->write_word(address, RS2, ~0UL);
+  STORE_DONE;
+
+do_sd:
+  address = RS1 + IMM;
+  if (address % 8 != 0) { FALLBACK; }
+  m->write_doubleword(address, RS2, ~0ULL);
+  STORE_DONE;
+
+do_jal:
+  RD = lpc + 4;
+  JUMP(lpc + IMM);
+
+do_jalr:
+  address = RS1 + IMM;
+  if (address == 0 && di->rd == 0 && di->rs1 == 0) {
+    // this signals that the program has ended
+    alive = false;
+  }
+  RD = lpc + 4;
+  JUMP(address);
+
+#define BRANCH(cond) \
+  if (cond) { JUMP(lpc + IMM); } \
+  instruction_count++; \
+  lpc += 4; \
+  num--; \
+  goto block_entry;
+
+do_beq:  BRANCH(RS1 == RS2);
+do_bne:  BRANCH(RS1 != RS2);
+do_blt:  BRANCH((int64_t)RS1 < (int64_t)RS2);
+do_bge:  BRANCH((int64_t)RS1 >= (int64_t)RS2);
+do_bltu: BRANCH(RS1 < RS2);
+do_bgeu: BRANCH(RS1 >= RS2);
+
+do_addiw: RD = (int64_t)(int32_t)((int32_t)RS1 + IMM); x[0] = 0; NEXT;
+do_slliw: RD = (int64_t)((int32_t)RS1 << di->rs2); x[0] = 0; NEXT;
+do_srliw: RD = (int64_t)(int32_t)((uint32_t)RS1 >> di->rs2); x[0] = 0; NEXT;
+do_sraiw: RD = (int64_t)((int32_t)RS1 >> di->rs2); x[0] = 0; NEXT;
+
+do_addw:  RD = (int64_t)(int32_t)((int32_t)RS1 + (int32_t)RS2); x[0] = 0; NEXT;
+do_subw:  RD = (int64_t)(int32_t)((int32_t)RS1 - (int32_t)RS2); x[0] = 0; NEXT;
+do_sllw:  RD = (int64_t)((int32_t)RS1 << (RS2 & 0x1F)); x[0] = 0; NEXT;
+do_srlw:  RD = (int64_t)(int32_t)((uint32_t)RS1 >> (RS2 & 0x1F)); x[0] = 0; NEXT;
+do_sraw:  RD = (int64_t)((int32_t)RS1 >> (RS2 & 0x1F)); x[0] = 0; NEXT;
+
+#define B ((di)[1])
+
+fused_lui_addi:
+  FUSED_CHECK;
+  RD = IMM + B.imm;
+  NEXT2;
+
+fused_lui_addiw:
+  FUSED_CHECK;
+  RD = (int64_t)(int32_t)((int32_t)IMM + B.imm);
+  NEXT2;
+
+fused_auipc_addi:
+  FUSED_CHECK;
+  RD = lpc + IMM + B.imm;
+  NEXT2;
+
+fused_auipc_jalr:
+  FUSED_CHECK;
+  address = lpc + IMM + B.imm;
+  RD = lpc + IMM;
+  x[B.rd] = lpc + 8;
+  instruction_count++;
+  num--;
+  JUMP(address);
+
+fused_slli_srli:
+  FUSED_CHECK;
+  RD = (RS1 << di->rs2) >> B.rs2;
+  NEXT2;
+
+fused_slli_srai:
+  FUSED_CHECK;
+  RD = (int64_t)(RS1 << di->rs2) >> B.rs2;
+  NEXT2;
+
+fused_set_branch: {
+  FUSED_CHECK;
+  uint64_t set;
+  switch (di->kind) {
+    case rv64::slt_k:   set = (int64_t)RS1 < (int64_t)RS2; break;
+    case rv64::sltu_k:  set = RS1 < RS2; break;
+    case rv64::slti_k:  set = (int64_t)RS1 < IMM; break;
+    default:            set = RS1 < (uint64_t)IMM; break;
+  }
+  RD = set;
+  instruction_count++;
+  lpc += 4;
+  num--;
+  di++;
+  BRANCH((di->kind == rv64::bne_k) == (set != 0));
+}
+
+#undef B
+
+done:
+  SYNC_OUT;
+  pc_changed = false;
+
+  // this only runs when the program has finished executing, which leaves a breakpoint at 0
+  if (!alive && !quiet) {
+    cout << "Breakpoint reached at "; show_pc();
+    set_breakpoint(0);
+  }
+  vlog("Finished execution block at pc: " << std::hex << pc << std::endl);
+
+#undef SYNC_OUT
+#undef SYNC_IN
+#undef NEXT
+#undef NEXT2
+#undef FUSED_CHECK
+#undef JUMP
+#undef FALLBACK
+#undef STORE_DONE
+#undef BRANCH
+#undef RD
+#undef RS1
+#undef RS2
+#undef IMM
+}
+
+#else
+
+// Without labels as values there is nothing to gain over the handler loop
+void processor::execute_threaded(unsigned int num, bool breakpoint_check) {
+  threaded = false;
+  execute(num, breakpoint_check);
+}
+
+#endif
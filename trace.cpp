@@ -0,0 +1,213 @@
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Class members for trace_writer and trace_reader
+
+**************************************************************** */
+
+#include <iostream>
+#include <cstring>
+#include <chrono>
+
+#include "trace.h"
+
+using namespace std;
+
+// How long the writing thread sleeps when there's nothing to write
+#define TRACE_DRAIN_WAIT_US 200
+
+// Reads are done in pieces this big
+#define TRACE_READ_BYTES (1 << 20)
+
+trace_state::trace_state() {
+  pc = 0 - 4ULL;    // so a trace starting at 0 needs no jump
+  address = 0;
+  for (int r = 0; r < 32; r++) regs[r] = 0;
+  for (int i = 0; i < TRACE_INST_SLOTS; i++) {
+    inst_pcs[i] = ~0ULL;
+    inst_words[i] = 0;
+  }
+  for (int i = 0; i < TRACE_VALUE_SLOTS; i++) values[i] = 0;
+}
+
+trace_writer::trace_writer() : filled(0), drained(0), closing(false) {
+  file = NULL;
+  failed = false;
+  out = NULL;
+  out_limit = NULL;
+}
+
+trace_writer::~trace_writer() {
+  close();
+}
+
+bool trace_writer::open(const string& path) {
+  close();
+  file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    cout << "Can't write trace to " << path << endl;
+    return false;
+  }
+  this->path = path;
+  // whole chunks are written at a time, there's nothing for stdio to gather
+  setvbuf(file, NULL, _IONBF, 0);
+  fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_BYTES, file);
+  chunks.assign((size_t)TRACE_CHUNKS * TRACE_CHUNK_BYTES, 0);
+  filled.store(0);
+  drained.store(0);
+  closing.store(false);
+  failed = false;
+  out = chunks.data();
+  out_limit = out + TRACE_CHUNK_BYTES - TRACE_RECORD_MAX;
+  state = trace_state();
+  drainer = thread(&trace_writer::drain, this);
+  return true;
+}
+
+// Give the full chunk to the thread and move on to the next one, once the thread has written it out
+void trace_writer::hand_over() {
+  uint64_t n = filled.load(memory_order_relaxed);
+  uint8_t* chunk = chunks.data() + (n % TRACE_CHUNKS) * TRACE_CHUNK_BYTES;
+  lengths[n % TRACE_CHUNKS] = out - chunk;
+  filled.store(n + 1, memory_order_release);
+
+  while (n + 1 - drained.load(memory_order_acquire) >= TRACE_CHUNKS)
+    this_thread::yield();
+  out = chunks.data() + ((n + 1) % TRACE_CHUNKS) * TRACE_CHUNK_BYTES;
+  out_limit = out + TRACE_CHUNK_BYTES - TRACE_RECORD_MAX;
+}
+
+void trace_writer::drain() {
+  uint64_t n = 0;
+  while (true) {
+    if (n < filled.load(memory_order_acquire)) {
+      const uint8_t* chunk = chunks.data() + (n % TRACE_CHUNKS) * TRACE_CHUNK_BYTES;
+      size_t length = lengths[n % TRACE_CHUNKS];
+      if (!failed && fwrite(chunk, 1, length, file) != length) failed = true;
+      n++;
+      drained.store(n, memory_order_release);
+    }
+    else if (closing.load(memory_order_acquire)) {
+      // everything was handed over before closing was set
+      if (n == filled.load(memory_order_acquire)) return;
+    }
+    else {
+      this_thread::sleep_for(chrono::microseconds(TRACE_DRAIN_WAIT_US));
+    }
+  }
+}
+
+bool trace_writer::close() {
+  if (file == NULL) return true;
+  // the last chunk is partly full, and the slot it's in is this thread's until it's handed over
+  uint64_t n = filled.load(memory_order_relaxed);
+  lengths[n % TRACE_CHUNKS] = out - (chunks.data() + (n % TRACE_CHUNKS) * TRACE_CHUNK_BYTES);
+  filled.store(n + 1, memory_order_release);
+  closing.store(true, memory_order_release);
+  drainer.join();
+
+  bool ok = !failed && fflush(file) == 0;
+  ok = fclose(file) == 0 && ok;
+  file = NULL;
+  chunks.clear();
+  if (!ok) cout << "Can't write trace to " << path << endl;
+  return ok;
+}
+
+trace_reader::trace_reader() {
+  file = NULL;
+  start = 0;
+  end = 0;
+}
+
+trace_reader::~trace_reader() {
+  if (file != NULL) fclose(file);
+}
+
+bool trace_reader::open(const string& path) {
+  file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    cout << "Can't read trace from " << path << endl;
+    return false;
+  }
+  char magic[TRACE_MAGIC_BYTES];
+  if (fread(magic, 1, TRACE_MAGIC_BYTES, file) != TRACE_MAGIC_BYTES || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_BYTES) != 0) {
+    cout << "Not a trace: " << path << endl;
+    return false;
+  }
+  buffer.assign(TRACE_READ_BYTES + TRACE_RECORD_MAX, 0);
+  start = 0;
+  end = 0;
+  state = trace_state();
+  return true;
+}
+
+bool trace_reader::get_varint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && start < end; shift += 7) {
+    uint8_t b = buffer[start++];
+    value |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+bool trace_reader::next(trace_record& record) {
+  // keep a whole record's worth in the buffer, unless the file has run out
+  if (end - start < TRACE_RECORD_MAX) {
+    memmove(buffer.data(), buffer.data() + start, end - start);
+    end -= start;
+    start = 0;
+    end += fread(buffer.data() + end, 1, TRACE_READ_BYTES, file);
+  }
+  if (start == end) return false;
+
+  uint8_t flags = buffer[start++];
+  bool ok = true;
+  uint64_t delta = 0;
+  record.pc = state.pc + 4;
+  if (flags & TRACE_JUMP) {
+    ok = ok && get_varint(delta);
+    record.pc += unzigzag(delta);
+  }
+  state.pc = record.pc;
+
+  unsigned int slot = (record.pc >> 2) & (TRACE_INST_SLOTS - 1);
+  if (flags & TRACE_INST) {
+    ok = ok && end - start >= 4;
+    if (ok) {
+      const uint8_t* p = &buffer[start];
+      state.inst_pcs[slot] = record.pc;
+      state.inst_words[slot] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+      start += 4;
+    }
+  }
+  ok = ok && state.inst_pcs[slot] == record.pc;
+  record.inst = state.inst_words[slot];
+
+  record.memory = flags & TRACE_MEMORY;
+  record.address = 0;
+  uint64_t* remembered = NULL;
+  if (record.memory && ok) {
+    ok = get_varint(delta);
+    state.address += unzigzag(delta);
+    record.address = state.address;
+    remembered = &state.values[(record.address >> 3) & (TRACE_VALUE_SLOTS - 1)];
+  }
+  record.write = flags & TRACE_WRITE;
+  record.value = 0;
+  if (record.write && ok) {
+    uint64_t& reg = state.regs[(record.inst >> 7) & 0x1F];
+    ok = get_varint(delta);
+    reg = (record.memory ? *remembered : reg) + unzigzag(delta);
+    record.value = reg;
+    if (record.memory) *remembered = reg;
+  }
+  else if (record.memory && ok) {
+    *remembered = state.regs[(record.inst >> 20) & 0x1F];
+  }
+
+  if (!ok) cout << "Trace ends partway through a record" << endl;
+  return ok;
+}
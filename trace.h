@@ -0,0 +1,193 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* ****************************************************************
+   RISC-V Instruction Set Simulator
+   Computer Architecture, Semester 1, 2023
+
+   Binary execution trace, written by rv64sim --trace and read by rv64trace
+
+**************************************************************** */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// First bytes of a trace file
+#define TRACE_MAGIC "RV64TRC1"
+#define TRACE_MAGIC_BYTES 8
+
+/**
+ * A record is a flags byte, then for each flag set, in this order:
+ *   jump      the pc, as a zigzag varint of how far it is from the last record's pc + 4
+ *   inst      the instruction word, 4 bytes little endian
+ *   memory    the load or store address, as a zigzag varint of the change from the last address
+ *   write     the value written to rd, as a zigzag varint of the change from a guess at it: for a load
+ *             the value last stored to or loaded from that address, otherwise the last value written to rd
+ * A record without inst has the word last seen at its pc, remembered in a direct-mapped table of
+ * TRACE_INST_SLOTS entries by both ends. Values at addresses are remembered the same way, in
+ * TRACE_VALUE_SLOTS entries of 8 bytes, with stores taking the last value written to their rs2
+ */
+#define TRACE_JUMP    0x01
+#define TRACE_INST    0x02
+#define TRACE_WRITE   0x04
+#define TRACE_MEMORY  0x08
+
+#define TRACE_INST_SLOTS 4096
+#define TRACE_VALUE_SLOTS 4096
+
+// Longest record: flags, three 10 byte varints and the word
+#define TRACE_RECORD_MAX 35
+
+// Buffer between the simulator and the thread writing the file
+#define TRACE_CHUNK_BYTES (1 << 20)
+#define TRACE_CHUNKS 8
+
+// One retired instruction
+struct trace_record {
+  uint64_t pc;
+  uint32_t inst;
+  bool write;           // rd was written, with value
+  uint64_t value;
+  bool memory;          // a load or store, at address
+  uint64_t address;
+};
+
+// What has been seen so far, which a record only has to give the changes from
+struct trace_state {
+  uint64_t pc;
+  uint64_t address;
+  uint64_t regs[32];
+  uint64_t inst_pcs[TRACE_INST_SLOTS];
+  uint32_t inst_words[TRACE_INST_SLOTS];
+  uint64_t values[TRACE_VALUE_SLOTS];
+
+  trace_state();
+};
+
+inline uint8_t* put_varint(uint8_t* p, uint64_t value) {
+  while (value >= 0x80) {
+    *p++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *p++ = value;
+  return p;
+}
+
+inline uint64_t zigzag(uint64_t delta) {
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+inline uint64_t unzigzag(uint64_t value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+// Encodes records into chunks of a ring that a thread of its own writes to the file, so the
+// simulator only waits when the disk falls TRACE_CHUNKS chunks behind. The simulator only moves
+// filled and the thread only moves drained, so neither needs a lock
+class trace_writer {
+
+  string path;
+  FILE* file;
+  thread drainer;
+  vector<uint8_t> chunks;             // TRACE_CHUNKS of TRACE_CHUNK_BYTES
+  size_t lengths[TRACE_CHUNKS];
+  atomic<uint64_t> filled;            // chunks handed to the thread
+  atomic<uint64_t> drained;           // chunks it has written
+  atomic<bool> closing;
+  bool failed;                        // set by the thread if a write fails
+
+  uint8_t* out;                       // next byte of the chunk being filled
+  uint8_t* out_limit;                 // where a record might not fit
+  trace_state state;
+
+  void hand_over();
+  void drain();
+
+ public:
+
+  trace_writer();
+  ~trace_writer();
+
+  // Start a trace file. Returns false, with a message, if it can't be created
+  bool open(const string& path);
+
+  // Write out what is left and close the file. Returns false, with a message, if anything couldn't be written
+  bool close();
+
+  // The instruction inst at pc retired, writing value to its rd if write and accessing memory at
+  // address if memory
+  inline void record(uint64_t pc, uint32_t inst, bool write, uint64_t value, bool memory, uint64_t address) {
+    uint8_t* p = out + 1;
+    uint8_t flags = 0;
+    if (pc != state.pc + 4) {
+      flags |= TRACE_JUMP;
+      p = put_varint(p, zigzag(pc - state.pc - 4));
+    }
+    state.pc = pc;
+
+    unsigned int slot = (pc >> 2) & (TRACE_INST_SLOTS - 1);
+    if (state.inst_pcs[slot] != pc || state.inst_words[slot] != inst) {
+      flags |= TRACE_INST;
+      p[0] = inst;
+      p[1] = inst >> 8;
+      p[2] = inst >> 16;
+      p[3] = inst >> 24;
+      p += 4;
+      state.inst_pcs[slot] = pc;
+      state.inst_words[slot] = inst;
+    }
+    uint64_t* remembered = NULL;
+    if (memory) {
+      flags |= TRACE_MEMORY;
+      p = put_varint(p, zigzag(address - state.address));
+      state.address = address;
+      remembered = &state.values[(address >> 3) & (TRACE_VALUE_SLOTS - 1)];
+    }
+    if (write) {
+      uint64_t& reg = state.regs[(inst >> 7) & 0x1F];
+      flags |= TRACE_WRITE;
+      p = put_varint(p, zigzag(value - (memory ? *remembered : reg)));
+      reg = value;
+      if (memory) *remembered = value;
+    }
+    else if (memory) {
+      *remembered = state.regs[(inst >> 20) & 0x1F];
+    }
+
+    *out = flags;
+    out = p;
+    if (out >= out_limit) hand_over();
+  }
+};
+
+// Reads the records back from a trace file
+class trace_reader {
+
+  FILE* file;
+  vector<uint8_t> buffer;
+  size_t start;         // next unread byte in buffer
+  size_t end;           // end of what has been read into it
+  trace_state state;
+
+  bool get_varint(uint64_t& value);
+
+ public:
+
+  trace_reader();
+  ~trace_reader();
+
+  // Returns false, with a message, if path can't be read or isn't a trace
+  bool open(const string& path);
+
+  // Read the next record. Returns false at the end of the trace, with a message if it ends partway
+  // through a record
+  bool next(trace_record& record);
+};
+
+#endif